@@ -23,6 +23,8 @@
 // included by <termios.h>
 #define BAUDRATE B9600         // For struct termios
 #define DEFAULT_BAUDRATE 9600  // For the delaying transmissions
+#define MIN_BAUDRATE 1200
+#define MAX_BAUDRATE 4000000
 #define _POSIX_SOURCE 1        // POSIX compliant source
 #define FALSE 0
 #define TRUE 1
@@ -235,8 +237,10 @@ void help()
            "--- on           : connect the cable and data is exchanged (default state)\n"
            "--- off          : disconnect the cable disabling data to be exchanged\n"
            "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
-           "--- baud <rate>  : set baud rate, between 1200 and 115200 (default=9600)\n"
+           "--- baud <rate>  : set baud rate, between 1200 and 4000000 (default=9600)\n"
            "                   note that 10 bits are sent per byte (8-N-1)\n"
+           "                   high rates are limited by how fast this host can\n"
+           "                   copy single bytes (see UNRELIABLE RATE)\n"
            "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
            "                   will be approximated to an integer multiple of the byte\n"
            "                   delay (10 / baud_rate)\n"
@@ -480,20 +484,14 @@ int main(int argc, char *argv[])
             {
                 unsigned long baud = 0;
                 sscanf(rxStdin + 5, "%lu", &baud);
-                switch (baud) {
-                    case 1200:
-                    case 1800:
-                    case 2400:
-                    case 4800:
-                    case 9600:
-                    case 19200:
-                    case 38400:
-                    case 57600:
-                    case 115200:
-                        set_baud_rate(baud);
-                        break;
-                    default:
-                        printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
+                // Any rate, like the ports of the application (termios2)
+                if (baud >= MIN_BAUDRATE && baud <= MAX_BAUDRATE)
+                {
+                    set_baud_rate(baud);
+                }
+                else
+                {
+                    printf("UNSUPPORTED BAUD RATE: must be between 1200 and 4000000\n");
                 }
             }
             else if (strncmp(rxStdin, "prop ", 5) == 0)
@@ -0,0 +1,34 @@
+// Link bonding header.
+
+#ifndef _BOND_H_
+#define _BOND_H_
+
+#include "link_layer.h"
+
+// Open more links to the same peer, one on each of the nPorts serial ports in
+// ports, with the other parameters in connectionParameters. Both ends must list
+// their ports in the same order. From then on frames are striped over these
+// links and the one opened by llopen(), through bondWrite() and bondRead().
+// Return "0" on success or "-1" on error.
+int bondStart(LinkLayer connectionParameters, char **ports, int nPorts);
+
+// Queue the data in buf with size bufSize on the link expected to deliver it
+// first, given the throughput measured on each link, and return once it is
+// queued. Frames of a link that stops answering are sent again on the others.
+// Return bufSize, or "-1" if every link is down.
+int bondWrite(const unsigned char *buf, int bufSize);
+
+// Wait until every frame given to bondWrite() is acknowledged.
+// Return "0" on success or "-1" if every link is down.
+int bondFlush();
+
+// Receive the next packet read on any of the links, in the order they arrive.
+// Return number of chars read, or LINK_BROKEN (see link_session.h) once every
+// link is down.
+int bondRead(unsigned char *packet);
+
+// Close the links opened by bondStart(), printing how much each link carried
+// if showStatistics == TRUE. The link opened by llopen() is left to llclose().
+void bondStop(int showStatistics);
+
+#endif // _BOND_H_
@@ -0,0 +1,46 @@
+// Logical channel scheduler header.
+
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+// Most logical channels sharing the link.
+#define MAX_CHANNELS 4
+
+// Sends one packet on the link, returning its size or "-1" on error.
+typedef int (*ChannelWriter)(const unsigned char *packet, int size);
+
+// Share the link, written through write, among nChannels logical channels,
+// each with its own queue. Higher channels are more urgent: their packets go
+// out first, so a small message never waits for more than the packet being
+// sent when it was queued (and the urgent ones queued before it). The calling
+// thread becomes the one writing to the link.
+// Return "0" on success or "-1" on error.
+int channelsStart(int nChannels, ChannelWriter write);
+
+// Queue packet on channel, from any thread, waiting while the channel's
+// queue is full. The packet is sent by the next channelSend() or
+// channelFlush(), or right away if the writing thread is idle.
+// Return "0" on success or "-1" if the channels were stopped.
+int channelQueue(int channel, const unsigned char *packet, int size);
+
+// Queue packet on channel and send queued packets, most urgent first, until
+// it is sent. Must only be called from the thread writing to the link.
+// Return its size, or "-1" on error.
+int channelSend(int channel, const unsigned char *packet, int size);
+
+// Send every queued packet, most urgent first.
+// Return "0" on success or "-1" on error.
+int channelFlush();
+
+// Let channelQueue() write to the link until channelBusy(), while the writing
+// thread waits for something else (e.g., the next file data).
+void channelIdle();
+
+// Take the link back from channelQueue(), waiting for the packet it's sending.
+void channelBusy();
+
+// Stop queuing, send the packets already queued and stop the channels.
+// Packets left when the link fails are dropped, reporting how many.
+void channelsStop();
+
+#endif // _CHANNEL_H_
@@ -0,0 +1,15 @@
+// File checksum header.
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <stddef.h>
+
+// Initial value of a running CRC-32C.
+#define CRC32C_INIT 0
+
+// Continue the CRC-32C (Castagnoli) crc over size bytes of data.
+// Safe to call from several threads.
+unsigned int crc32c(unsigned int crc, const unsigned char *data, size_t size);
+
+#endif // _CHECKSUM_H_
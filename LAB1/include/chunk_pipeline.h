@@ -0,0 +1,45 @@
+// Transmitter chunk pipeline header.
+
+#ifndef _CHUNK_PIPELINE_H_
+#define _CHUNK_PIPELINE_H_
+
+#include <stdio.h>
+
+#include "link_layer.h"
+
+// Header of the DATA packets that carry the chunks: type, file offset of the
+// payload (OFFSET_SIZE bytes) and payload size (2 bytes).
+#define OFFSET_SIZE 8
+#define DATA_HEADER_SIZE (1 + OFFSET_SIZE + 2)
+
+// Raw bytes of file read into each chunk: as many as a DATA packet carries
+// after its header, so it fits in MAX_PAYLOAD_SIZE.
+#define CHUNK_SIZE (MAX_PAYLOAD_SIZE - DATA_HEADER_SIZE)
+
+typedef struct
+{
+    int seq;                              // Position of the chunk in the file
+    int rawSize;                          // Number of file bytes in the chunk
+    int size;                             // Number of bytes in data
+    int compressed;                       // TRUE if data holds the compressed chunk
+    unsigned char data[CHUNK_SIZE];
+} Chunk;
+
+// Start reading file in chunks. If compress is TRUE, chunks are compressed by
+// nThreads worker threads while the caller sends earlier chunks. checksum is
+// the CRC-32C of the bytes before the current position of file.
+// Return "0" on success or "-1" on error.
+int pipelineStart(FILE *file, int compress, int nThreads, unsigned int checksum);
+
+// Wait for the next chunk in file order.
+// Return "1" if a chunk was stored in chunk, "0" at end of file or "-1" on error.
+int pipelineNext(Chunk *chunk);
+
+// CRC-32C of the file bytes read so far, continuing the one given to
+// pipelineStart (of the whole file once pipelineNext returned "0").
+unsigned int pipelineChecksum();
+
+// Stop the worker threads and release the pipeline.
+void pipelineStop();
+
+#endif // _CHUNK_PIPELINE_H_
@@ -0,0 +1,15 @@
+// Chunk compression header.
+
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+// Compress inSize bytes of in into out (LZ77 byte-oriented format).
+// Return the compressed size, or "-1" if it does not fit in outCapacity bytes.
+int compressChunk(const unsigned char *in, int inSize, unsigned char *out, int outCapacity);
+
+// Decompress inSize bytes of in into out.
+// Return the decompressed size, or "-1" if the input is malformed or does not
+// fit in outCapacity bytes.
+int decompressChunk(const unsigned char *in, int inSize, unsigned char *out, int outCapacity);
+
+#endif // _COMPRESSION_H_
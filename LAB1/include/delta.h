@@ -0,0 +1,41 @@
+// Delta transfer header.
+
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <stddef.h>
+
+// Size of the blocks the receiver signs in its copy of the file.
+#define DELTA_BLOCK_SIZE 2048
+
+typedef struct
+{
+    unsigned int weak;        // Rolling checksum of the block
+    unsigned long long strong; // Strong hash confirming a rolling checksum match
+} BlockSignature;
+
+// Callbacks through which deltaScan describes the new file, in order.
+// Return "0" to continue or "-1" to abort the scan.
+typedef struct
+{
+    int (*literal)(void *ctx, const unsigned char *data, int size);
+    int (*copy)(void *ctx, unsigned int firstBlock, unsigned int count);
+    void *ctx;
+} DeltaEmitter;
+
+// Rolling checksum of size bytes of data.
+unsigned int weakChecksum(const unsigned char *data, int size);
+
+// Slide a size-byte rolling checksum one byte forward, dropping out and adding in.
+unsigned int rollChecksum(unsigned int sum, unsigned char out, unsigned char in, int size);
+
+// Strong hash of size bytes of data.
+unsigned long long strongChecksum(const unsigned char *data, int size);
+
+// Describe data as runs of literal bytes (at most maxLiteral each) and copies
+// of blocks of blockSize bytes matching one of the nSigs signatures.
+// Return "0" on success or "-1" if an emitter callback failed.
+int deltaScan(const unsigned char *data, size_t size, const BlockSignature *sigs, int nSigs,
+              int blockSize, int maxLiteral, DeltaEmitter *emitter);
+
+#endif // _DELTA_H_
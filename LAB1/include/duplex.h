@@ -0,0 +1,16 @@
+// Full-duplex link header.
+
+#ifndef _DUPLEX_H_
+#define _DUPLEX_H_
+
+// Switch the link opened by llopen() to full-duplex operation: from then on
+// both ends may send I-frames at the same time, calling llwrite() and llread()
+// from different threads. Each direction keeps its own sequence numbers.
+// Return "0" on success or "-1" on error.
+int duplexStart();
+
+// Return the link to half-duplex operation, e.g. before llclose(). Must only
+// be called once no llwrite() or llread() is in progress.
+void duplexStop();
+
+#endif // _DUPLEX_H_
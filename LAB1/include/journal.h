@@ -0,0 +1,26 @@
+// Receiver checkpoint journal header.
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdio.h>
+
+// Number of DATA packets received between checkpoints.
+#define JOURNAL_INTERVAL 16
+
+// Return the offset up to which a previous transfer of fileSize bytes into
+// filename was committed, or "0" if there is no matching journal.
+size_t journalLoad(const char *filename, size_t fileSize);
+
+// Start journaling the transfer of fileSize bytes into filename.
+// Return "0" on success or "-1" on error.
+int journalOpen(const char *filename, size_t fileSize);
+
+// Flush file to disk and record that its first offset bytes are committed.
+// Return "0" on success or "-1" on error.
+int journalCommit(FILE *file, size_t offset);
+
+// Stop journaling. If completed is TRUE the journal is deleted.
+void journalClose(int completed);
+
+#endif // _JOURNAL_H_
@@ -0,0 +1,402 @@
+// C++20 coroutine front-end for the link layer.
+//
+// Wraps link sessions (link_session.h) as awaitables driven by one LinkLoop
+// (link_loop.h), so many links run as coroutines on a single thread:
+//
+//     rcom::EventLoop loop;
+//
+//     loop.spawn([](rcom::EventLoop &loop, LinkLayer params) -> rcom::Task {
+//         rcom::Session link = co_await loop.open(params);
+//         if (!link) co_return;
+//
+//         unsigned char packet[MAX_PAYLOAD_SIZE];
+//         int size = co_await link.read(packet);
+//         co_await link.write(packet, size);
+//     }(loop, params));
+//
+//     loop.run();
+//
+// Reads and writes never block the thread: frames go through linkSubmit() and
+// packets arrive through the session's packet handler. Opening and closing
+// (the SET and DISC handshakes) still block in the C API, so they run on a
+// thread of their own while the loop keeps going. A Session closes its link
+// when it goes out of scope, with the DISC handshake on a thread of its own
+// too, unless it was closed with co_await close() already; run() doesn't
+// return before that handshake ends.
+
+#ifndef _LINK_ASYNC_HPP_
+#define _LINK_ASYNC_HPP_
+
+extern "C" {
+#include "link_layer.h"
+#include "link_loop.h"
+#include "link_session.h"
+}
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rcom {
+
+class EventLoop;
+
+// A coroutine started with EventLoop::spawn(). It first runs from
+// EventLoop::run(), and is freed when it returns.
+class Task {
+public:
+    struct promise_type {
+        EventLoop *loop = nullptr;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    ~Task() {
+        // Only a task that was never spawned still owns its frame
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+private:
+    friend class EventLoop;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+class Session;
+
+// Runs spawned tasks and drives the links they open, from the thread calling
+// run(). Must outlive its tasks and sessions.
+class EventLoop {
+public:
+    EventLoop() : loop(loopCreate()) {
+        if (!loop) {
+            throw std::bad_alloc();
+        }
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    ~EventLoop() { loopDestroy(loop); }
+
+    // Start task; it runs once run() is called (or right away, from a task).
+    void spawn(Task task) {
+        auto handle = std::exchange(task.handle, nullptr);
+
+        handle.promise().loop = this;
+        tasks++;
+        schedule(handle);
+    }
+
+    // Run the tasks and drive their links until every task has returned and
+    // the links they left open are closed.
+    // Return "0" on success or "-1" if the loop fails or the tasks left wait
+    // for something that can never happen.
+    int run() {
+
+        while (tasks > 0 || blocking > 0) {
+            takePosted();
+
+            while (!ready.empty()) {
+                auto handle = ready.front();
+                ready.pop_front();
+                handle.resume();
+                takePosted();
+            }
+
+            if (tasks == 0 && blocking == 0) {
+                break;
+            }
+
+            if (blocking > 0 && sessions == 0) {
+                // Only a blocked handshake can wake a task up
+                std::unique_lock<std::mutex> guard(lock);
+                posted.wait(guard, [this] { return !fromThreads.empty(); });
+            } else if (blocking > 0) {
+                // Keep an eye on the handshakes while driving the links
+                if (loopRunFor(loop, HANDSHAKE_CHECK) < 0) {
+                    return -1;
+                }
+            } else if (sessions > 0) {
+                // Returns with no task ready if the loop dropped every link
+                // after an error, which nothing will resume
+                if (loopRun(loop) < 0 || ready.empty()) {
+                    return -1;
+                }
+            } else {
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    // Open a link with the SET/UA handshake (see linkOpen()). The session is
+    // false if it fails.
+    auto open(LinkLayer parameters);
+
+private:
+    friend class Session;
+    friend class Task;
+
+    // Seconds between looks at the handshakes running on other threads
+    static constexpr double HANDSHAKE_CHECK = 0.01;
+
+    // Resume handle from run(), once the callback calling this returns.
+    void schedule(std::coroutine_handle<> handle) {
+        ready.push_back(handle);
+        loopStop(loop);
+    }
+
+    // Run work on a thread of its own, then resume handle from run() (if it
+    // isn't null).
+    template <typename Work>
+    void runBlocking(std::coroutine_handle<> handle, Work work) {
+        blocking++;
+
+        std::thread([this, handle, work]() mutable {
+            work();
+
+            std::lock_guard<std::mutex> guard(lock);
+            fromThreads.push_back(handle);
+            posted.notify_one();
+        }).detach();
+    }
+
+    // Move the handles posted by runBlocking() threads to the ready ones.
+    void takePosted() {
+        std::lock_guard<std::mutex> guard(lock);
+
+        while (!fromThreads.empty()) {
+            if (fromThreads.front()) {
+                ready.push_back(fromThreads.front());
+            }
+            fromThreads.pop_front();
+            blocking--;
+        }
+    }
+
+    LinkLoop *loop;
+    std::deque<std::coroutine_handle<>> ready;
+    int tasks = 0;
+    int sessions = 0;       // Added to loop
+    int blocking = 0;       // Handshakes running on other threads
+
+    std::mutex lock;
+    std::condition_variable posted;
+    std::deque<std::coroutine_handle<>> fromThreads;
+};
+
+inline void Task::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+    handle.promise().loop->tasks--;
+    handle.destroy();
+}
+
+// An open link, driven by its EventLoop. Move-only; closes the link (with the
+// DISC handshake, on a thread of its own) when destroyed while open.
+class Session {
+public:
+    Session() = default;
+    Session(Session &&) noexcept = default;
+
+    Session &operator=(Session &&other) noexcept {
+        if (this != &other) {
+            closeNow();
+            state = std::move(other.state);
+        }
+        return *this;
+    }
+
+    ~Session() { closeNow(); }
+
+    explicit operator bool() const { return state && state->session; }
+
+    // Send size bytes of buf as one frame, after the ones already queued.
+    // Resumes with the number of chars written, or "-1" on error.
+    auto write(const unsigned char *buf, int size) {
+        struct Awaiter {
+            State *state;
+            const unsigned char *buf;
+            int size;
+            int result = -1;
+            std::coroutine_handle<> handle;
+
+            bool await_ready() { return !state || !state->session; }
+
+            bool await_suspend(std::coroutine_handle<> h) {
+                handle = h;
+                return linkSubmit(state->session, buf, size, done, this) == 0;
+            }
+
+            int await_resume() { return result; }
+
+            static void done(LinkSession *, int result, void *context) {
+                auto *awaiter = static_cast<Awaiter *>(context);
+
+                awaiter->result = result;
+                awaiter->state->loop->schedule(awaiter->handle);
+            }
+        };
+
+        return Awaiter{state.get(), buf, size, -1, {}};
+    }
+
+    // Receive the next packet into packet (at least MAX_PAYLOAD_SIZE bytes).
+    // Resumes with its size, or "-1" if the link was closed.
+    auto read(unsigned char *packet) {
+        struct Awaiter {
+            State *state;
+            unsigned char *packet;
+
+            bool await_ready() { return !state || !state->session || !state->packets.empty(); }
+
+            void await_suspend(std::coroutine_handle<> handle) { state->reader = handle; }
+
+            int await_resume() {
+                if (!state || state->packets.empty()) {
+                    return -1;
+                }
+
+                std::vector<unsigned char> next = std::move(state->packets.front());
+                state->packets.pop_front();
+                std::memcpy(packet, next.data(), next.size());
+                return static_cast<int>(next.size());
+            }
+        };
+
+        return Awaiter{state.get(), packet};
+    }
+
+    // Close the link with the DISC handshake, printing its statistics if
+    // showStatistics == TRUE. Resumes with "1" on success or "-1" on error.
+    auto close(int showStatistics = FALSE) {
+        struct Awaiter {
+            State *state;
+            int showStatistics;
+            int result = -1;
+
+            bool await_ready() { return !state || !state->session; }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                LinkSession *session = state->release();
+
+                state->loop->runBlocking(handle, [this, session] {
+                    result = linkClose(session, showStatistics);
+                });
+            }
+
+            int await_resume() { return result; }
+        };
+
+        return Awaiter{state.get(), showStatistics};
+    }
+
+private:
+    friend class EventLoop;
+
+    struct State {
+        EventLoop *loop;
+        LinkSession *session;
+        std::deque<std::vector<unsigned char>> packets;
+        std::coroutine_handle<> reader;
+
+        // Stop driving the session and hand it over to be closed. A pending
+        // read resumes with "-1".
+        LinkSession *release() {
+            LinkSession *closed = std::exchange(session, nullptr);
+
+            loopRemove(loop->loop, closed);
+            loop->sessions--;
+
+            if (reader) {
+                loop->schedule(std::exchange(reader, nullptr));
+            }
+            return closed;
+        }
+
+        static void packetReceived(LinkSession *, const unsigned char *packet, int size, void *context) {
+            auto *state = static_cast<State *>(context);
+
+            state->packets.emplace_back(packet, packet + size);
+
+            if (state->reader) {
+                state->loop->schedule(std::exchange(state->reader, nullptr));
+            }
+        }
+    };
+
+    Session(EventLoop *loop, LinkSession *session) : state(new State{loop, session, {}, nullptr}) {
+        linkSetPacketHandler(session, State::packetReceived, state.get());
+
+        if (loopAdd(loop->loop, session) < 0) {
+            loop->runBlocking(nullptr, [session] { linkClose(session, FALSE); });
+            state->session = nullptr;
+            return;
+        }
+        loop->sessions++;
+    }
+
+    // Start closing the link without waiting for it, see EventLoop::run().
+    void closeNow() {
+        if (state && state->session) {
+            LinkSession *session = state->release();
+
+            state->loop->runBlocking(nullptr, [session] { linkClose(session, FALSE); });
+        }
+    }
+
+    std::unique_ptr<State> state;
+};
+
+inline auto EventLoop::open(LinkLayer parameters) {
+    struct Awaiter {
+        EventLoop *loop;
+        LinkLayer parameters;
+        LinkSession *session = nullptr;
+
+        bool await_ready() { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop->runBlocking(handle, [this] { session = linkOpen(parameters); });
+        }
+
+        Session await_resume() {
+            return session ? Session(loop, session) : Session();
+        }
+    };
+
+    return Awaiter{this, parameters};
+}
+
+} // namespace rcom
+
+#endif // _LINK_ASYNC_HPP_
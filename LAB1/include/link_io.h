@@ -0,0 +1,39 @@
+// Serial port I/O threads header.
+
+#ifndef _LINK_IO_H_
+#define _LINK_IO_H_
+
+// The I/O threads of one serial port: an RX thread reading the port into a
+// ring of received bytes and a TX thread writing a ring of bytes to send to
+// the port. Each ring has a single producer and a single consumer, so the
+// protocol engine never waits on the wire while it parses or builds frames.
+typedef struct LinkIo LinkIo;
+
+// Start the I/O threads of the serial port opened as fd.
+// Return them, or NULL on error.
+LinkIo *ioStart(int fd);
+
+// Read up to numBytes received bytes. If wait == TRUE and there are none, wait
+// up to 0.1 second for them (like serialRead()); otherwise return at once.
+// Returns -1 on error, otherwise the number of bytes read.
+int ioRead(LinkIo *io, unsigned char *bytes, int numBytes, int wait);
+
+// Queue up to numBytes to be sent, without waiting for room. Must only be
+// called by one thread at a time.
+// Returns -1 on error, otherwise the number of bytes queued, which is short
+// (even "0") while the ring is full.
+int ioWrite(LinkIo *io, const unsigned char *bytes, int numBytes);
+
+// Return a file descriptor that is writable (POLLOUT) when ioWrite() can queue
+// more bytes, for epoll and poll.
+int ioWritableFd(LinkIo *io);
+
+// Return a file descriptor that is readable while received bytes wait for
+// ioRead(), for epoll and poll.
+int ioEventFd(LinkIo *io);
+
+// Wait for the queued bytes to be sent, then stop the threads and free them.
+// The serial port is left open.
+void ioStop(LinkIo *io);
+
+#endif // _LINK_IO_H_
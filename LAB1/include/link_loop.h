@@ -0,0 +1,40 @@
+// Link event loop header.
+
+#ifndef _LINK_LOOP_H_
+#define _LINK_LOOP_H_
+
+#include "link_session.h"
+
+// Drives any number of link sessions from a single thread: waits on all their
+// serial ports at once (epoll) and runs each session's frame parser and
+// retransmission timer as its port becomes readable or its timer runs out. A
+// frame the port only took part of goes on once the port is writable.
+// Sessions are opened and closed as usual, but must be removed from the loop
+// before linkClose().
+typedef struct LinkLoop LinkLoop;
+
+// Return a new loop driving no sessions, or NULL on error.
+LinkLoop *loopCreate();
+
+// Start driving session (its transport needs a file descriptor, see linkFd()).
+// Return "0" on success or "-1" on error.
+int loopAdd(LinkLoop *loop, LinkSession *session);
+
+// Stop driving session. May be called from the session's callbacks.
+void loopRemove(LinkLoop *loop, LinkSession *session);
+
+// Drive the sessions until loopStop() is called (usually from one of their
+// callbacks) or none are left.
+// Return "0" on success or "-1" on error.
+int loopRun(LinkLoop *loop);
+
+// Like loopRun(), but also return once seconds have passed.
+int loopRunFor(LinkLoop *loop, double seconds);
+
+// Make loopRun() return as soon as the callback calling this does.
+void loopStop(LinkLoop *loop);
+
+// Free the loop, leaving its sessions open.
+void loopDestroy(LinkLoop *loop);
+
+#endif // _LINK_LOOP_H_
@@ -0,0 +1,119 @@
+// Link session header.
+
+#ifndef _LINK_SESSION_H_
+#define _LINK_SESSION_H_
+
+#include "link_layer.h"
+
+// One open link: its serial port, timers, sequence numbers and statistics.
+// Sessions share nothing, so a process can drive several links at once.
+// llopen(), llwrite(), llread() and llclose() work on a single default session.
+typedef struct LinkSession LinkSession;
+
+// Open a connection using the "port" parameters defined in connectionParameters.
+// Return the new session, or NULL on error.
+LinkSession *linkOpen(LinkLayer connectionParameters);
+
+// Send data in buf with size bufSize.
+// Return number of chars written, or "-1" on error.
+int linkWrite(LinkSession *session, const unsigned char *buf, int bufSize);
+
+// Returned by linkRead() (and llread()) instead of "-1" when the transport
+// failed, e.g. the other end closed its socket, so no retransmission will come.
+#define LINK_BROKEN (-2)
+
+// Receive data in packet.
+// Return number of chars read, "-1" on error (a rejected frame, which the
+// other end sends again) or LINK_BROKEN.
+int linkRead(LinkSession *session, unsigned char *packet);
+
+// Close the connection and free the session, printing its statistics if
+// showStatistics == TRUE.
+// Return "1" on success or "-1" on error.
+int linkClose(LinkSession *session, int showStatistics);
+
+// Close the connection without the DISC handshake (e.g., when the line is
+// down) and free the session.
+void linkAbort(LinkSession *session);
+
+// Return the session opened by llopen(), or NULL if there is none.
+LinkSession *linkDefault();
+
+// Switch the session to full-duplex operation (see duplexStart()).
+// Return "0" on success or "-1" on error.
+int linkStartDuplex(LinkSession *session);
+
+// Return the session to half-duplex operation (see duplexStop()).
+void linkStopDuplex(LinkSession *session);
+
+// The functions below let an event loop (see link_loop.h), or the caller with
+// linkPoll(), drive the session without blocking. They don't apply to
+// full-duplex sessions.
+
+// Called once a frame given to linkSubmit() is acknowledged (result is the
+// number of chars written) or runs out of retries (result is "-1").
+typedef void (*LinkWriteDone)(LinkSession *session, int result, void *context);
+
+// Called with each new packet the session reads in linkProcessInput(). packet
+// is only valid until the handler returns.
+typedef void (*LinkPacketHandler)(LinkSession *session, const unsigned char *packet, int size, void *context);
+
+// Return a file descriptor that is readable when the session received bytes:
+// its serial port, or the ring of its RX thread (see options.ioThreads), or
+// "-1" if its transport has none (see transport.h).
+int linkFd(LinkSession *session);
+
+// Queue the data in buf with size bufSize to be sent after the frames already
+// queued, and return at once. done (if not NULL) is called with the outcome,
+// usually from linkProcessInput() or linkProcessTimer().
+// Return "0" on success or "-1" on error.
+int linkSubmit(LinkSession *session, const unsigned char *buf, int bufSize, LinkWriteDone done, void *context);
+
+// Hand each packet read by linkProcessInput() to handler.
+void linkSetPacketHandler(LinkSession *session, LinkPacketHandler handler, void *context);
+
+// Return the number of frames queued or waiting for their acknowledgement.
+int linkPending(LinkSession *session);
+
+// Read what the serial port has received and handle the frames it completes.
+// Return the number of bytes read, or "-1" on error (failing the queued frames).
+int linkProcessInput(LinkSession *session);
+
+// Return TRUE while the frame being sent is only partly written, because the
+// transport was full. The rest goes out from linkProcessOutput().
+int linkOutputPending(LinkSession *session);
+
+// Return a file descriptor that is writable when linkProcessOutput() can go on,
+// or "-1" if the transport has none (then call it again later).
+int linkWriteFd(LinkSession *session);
+
+// Write more of the frame being sent, if linkOutputPending().
+// Return "0" on success or "-1" on error (failing the queued frames).
+int linkProcessOutput(LinkSession *session);
+
+// Return TRUE once the other end started closing the connection: its first DISC
+// was read by linkProcessInput(), and linkClose() won't wait for it.
+int linkClosing(LinkSession *session);
+
+// Retransmit the frame waiting for its acknowledgement if its timer ran out,
+// or, once it is out of retries and reconnecting, send the next SET frame (the
+// UA that answers it is read by linkProcessInput()). Never blocks.
+// Return the seconds left until the timer runs out, or "-1" if it isn't running.
+double linkProcessTimer(LinkSession *session);
+
+// Drive the session without an event loop: read what the other end sends and
+// retransmit on timeouts, for up to seconds (forever if negative) or until a
+// queued frame is acknowledged or fails. Bytes after the frame that completes
+// it are kept for linkRead(). linkWrite() is linkSubmit() and linkPoll() until
+// its frame is done, so the two can be mixed; frames stay in order.
+// Return the number of frames still queued, or "-1" on error.
+int linkPoll(LinkSession *session, double seconds);
+
+// Whether a frame that runs out of retries waits for the link to come back
+// (see options.reconnect, the default) instead of failing.
+void linkSetReconnect(LinkSession *session, int reconnect);
+
+// Return the seconds on a monotonic clock, for timeouts and rates.
+double linkTime();
+
+#endif // _LINK_SESSION_H_
@@ -0,0 +1,42 @@
+// io_uring serial port backend header.
+
+#ifndef _LINK_URING_H_
+#define _LINK_URING_H_
+
+// Serial port I/O through an io_uring of its own (raw system calls, no
+// liburing). A read is kept in flight, linked to a 0.1 second timeout (like
+// VTIME), into the next of several registered buffers, so the port is read
+// ahead while earlier bytes are parsed; writes are copied into registered
+// buffers, small ones sharing a buffer, and every buffer ready goes out in one
+// chain of linked writes, submitted together with the next read in a single
+// system call.
+typedef struct UringIo UringIo;
+
+// Set up an io_uring for the serial port opened as fd.
+// Return it, or NULL if the kernel doesn't support io_uring (or it is not
+// allowed), so the caller can fall back to read() and write().
+UringIo *uringStart(int fd);
+
+// Read up to numBytes received bytes. If wait == TRUE and there are none,
+// wait up to 0.1 second for them (like serialRead()).
+// Returns -1 on error, otherwise the number of bytes read.
+int uringRead(UringIo *io, unsigned char *bytes, int numBytes, int wait);
+
+// Queue numBytes to be written after the bytes already queued. Never waits.
+// Returns -1 on error, otherwise the number of bytes queued, which is short
+// (even "0") while every write buffer is in use.
+int uringWrite(UringIo *io, const unsigned char *bytes, int numBytes);
+
+// Return a file descriptor that is readable while received bytes wait for
+// uringRead(), for epoll and poll.
+int uringEventFd(UringIo *io);
+
+// Return a file descriptor that is writable (POLLOUT) when uringWrite() can
+// queue more bytes, for epoll and poll.
+int uringWritableFd(UringIo *io);
+
+// Wait for the queued bytes to be written, then tear the io_uring down. The
+// serial port is left open.
+void uringStop(UringIo *io);
+
+#endif // _LINK_URING_H_
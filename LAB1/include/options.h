@@ -0,0 +1,47 @@
+// Command-line options header.
+
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+
+// Serial port flow control, see --flow
+typedef enum {
+    FLOW_NONE,
+    FLOW_RTSCTS,    // Hardware: the RTS and CTS lines (CRTSCTS)
+    FLOW_XONXOFF,   // Software: XON and XOFF bytes in the data (IXON and IXOFF)
+} FlowControl;
+
+typedef struct
+{
+    int compress;        // TRUE if data chunks should be compressed before sending
+    int compressThreads; // Number of worker threads compressing chunks
+    int delta;           // TRUE to send only the blocks missing from the receiver's file
+    int resume;          // TRUE to continue from the offset the receiver last committed
+    int reconnect;       // TRUE to keep re-establishing the link instead of giving up
+    int reconnectLimit;  // Seconds to keep trying to reconnect (0 = forever)
+    char **files;        // More files to send in the same session
+    int nFiles;
+    int duplex;          // TRUE to send and receive files at the same time
+    const char *duplexTarget; // Where the transmitter stores the files it receives
+    char **bondPorts;    // More serial ports to the same peer, to stripe frames over
+    int nBondPorts;
+    int ioThreads;       // TRUE to move serial reads and writes to threads of their own
+    int ioUring;         // TRUE to do serial reads and writes through io_uring
+    const char *messages; // Lines to send as messages (tx) or file to append them to (rx)
+    int vtime;           // Deciseconds a serial read waits for the first byte (VTIME)
+    int lowLatency;      // TRUE for the low-latency profile (driver flag, locked memory)
+    int rtPriority;      // SCHED_FIFO priority of the process (0 = normal scheduling)
+    FlowControl flow;    // Flow control of the serial ports
+} Options;
+
+// Options in use by the application, filled by parseOptions().
+extern Options options;
+
+// Parse the optional arguments given after the filename (e.g., "--compress=4").
+// Arguments that are not options name more files to send.
+// Return "0" on success or "-1" on an unknown or malformed option.
+int parseOptions(int argc, char *argv[]);
+
+// Print the list of supported optional arguments.
+void printOptionsUsage();
+
+#endif // _OPTIONS_H_
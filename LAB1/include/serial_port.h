@@ -1,9 +1,65 @@
 // Serial port header.
-// NOTE: This file must not be changed.
 
 #ifndef _SERIAL_PORT_H_
 #define _SERIAL_PORT_H_
 
+#include <termios.h>
+
+// The flow control bytes of --flow=xonxoff (DC1 and DC3)
+#define XON  0x11
+#define XOFF 0x13
+
+// Each of these functions works on the serial port opened as fd, so several
+// ports can be open at once.
+
+// Open and configure the serial port, saving its settings in oldtio.
+// Returns the file descriptor of the port, or -1 on error.
+int serialOpen(const char *serialPort, int baudRate, struct termios *oldtio);
+
+// Set the serial port opened as fd to baudRate, which needs no B constant
+// (termios2 with BOTHER). serialOpen() calls it for the rates without one.
+// Returns the rate the driver actually set, or -1 on error.
+int serialSetSpeed(int fd, int baudRate);
+
+// Make a read of the serial port opened as fd wait up to vtime deciseconds
+// for the first byte (VTIME; serialOpen() sets 1). With "0" it returns at once.
+// Returns -1 on error.
+int serialSetReadTimeout(int fd, int vtime);
+
+// Ask the driver of the serial port opened as fd to hand received bytes over
+// at once (ASYNC_LOW_LATENCY) instead of batching them.
+// Returns -1 on error, or if the driver doesn't support it.
+int serialSetLowLatency(int fd);
+
+// Turn on flow control of the serial port opened as fd: hardware (RTS/CTS) if
+// rtscts is TRUE, software (XON/XOFF, both ways) if xonxoff is TRUE.
+// Returns -1 on error.
+int serialSetFlowControl(int fd, int rtscts, int xonxoff);
+
+// Return the receive overruns the driver of the serial port opened as fd
+// counted so far (bytes lost to a full hardware FIFO or driver buffer), or -1
+// if it doesn't count them.
+int serialOverruns(int fd);
+
+// Restore the settings in oldtio and close the serial port.
+// Returns -1 on error.
+int serialClose(int fd, const struct termios *oldtio);
+
+// Wait up to 0.1 second (VTIME) for a byte received from the serial port.
+// Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
+int serialReadByte(int fd, unsigned char *byte);
+
+// Read up to numBytes already received from the serial port, waiting up to 0.1
+// second (VTIME) if there are none.
+// Returns -1 on error, otherwise the number of bytes read.
+int serialRead(int fd, unsigned char *bytes, int numBytes);
+
+// Write up to numBytes to the serial port.
+// Returns -1 on error, otherwise the number of bytes written.
+int serialWrite(int fd, const unsigned char *bytes, int numBytes);
+
+// The functions below work on a single port, the one opened by openSerialPort().
+
 // Open and configure the serial port.
 // Returns -1 on error.
 int openSerialPort(const char *serialPort, int baudRate);
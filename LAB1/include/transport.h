@@ -0,0 +1,64 @@
+// Link transport header.
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "link_layer.h"
+
+// What carries a session's bytes. The link layer only reads and writes bytes
+// through these operations, so the same protocol runs over a serial port or,
+// to test and profile it without baud-rate limits, over a socket or a
+// shared-memory ring. The backend is chosen by the "serial port" name:
+//   /dev/ttyS10        termios serial port (--io-threads and --io-uring apply)
+//   unix:/tmp/link     Unix stream socket at that path
+//   tcp:host:port      TCP connection (host may be empty)
+//   shm:/link          shared-memory ring pair (see shm_open())
+// For sockets and shared memory the receiver waits for the transmitter: it
+// listens (or creates the ring pair) and the transmitter connects.
+typedef struct Transport Transport;
+
+typedef struct {
+    // Read up to numBytes received bytes. If wait == TRUE and there are none,
+    // wait up to 0.1 second for them; otherwise it may return "0" at once.
+    // Returns -1 on error, otherwise the number of bytes read.
+    int (*read)(Transport *transport, unsigned char *bytes, int numBytes, int wait);
+
+    // Write up to numBytes (or queue them to be written, in order) without
+    // waiting for room.
+    // Returns -1 on error, otherwise the number of bytes written, which is
+    // short (even "0") while the transport is full.
+    int (*write)(Transport *transport, const unsigned char *bytes, int numBytes);
+
+    // Return a file descriptor that is readable when bytes were received, for
+    // epoll and poll, or "-1" if the transport has none.
+    int (*pollFd)(Transport *transport);
+
+    // Return a file descriptor that is writable when a short write can go on,
+    // or "-1" if the transport has none (the caller then tries again later).
+    int (*writeFd)(Transport *transport);
+
+    // Return the received bytes the transport lost so far because they came
+    // in faster than it could take them (serial receive overruns), or "-1"
+    // if it can't tell.
+    int (*overruns)(Transport *transport);
+
+    // Send what is queued, close the transport and free it.
+    // Returns -1 on error.
+    int (*close)(Transport *transport);
+} TransportOps;
+
+// Each backend starts with this
+struct Transport {
+    const TransportOps *ops;
+};
+
+// Open the transport named by connectionParameters.serialPort.
+// Return it, or NULL on error.
+Transport *transportOpen(LinkLayer connectionParameters);
+
+// The backends, called by transportOpen() with the name (without its prefix).
+Transport *serialTransportOpen(LinkLayer connectionParameters);
+Transport *socketTransportOpen(LinkLayer connectionParameters, const char *address, int tcp);
+Transport *shmTransportOpen(LinkLayer connectionParameters, const char *name);
+
+#endif // _TRANSPORT_H_
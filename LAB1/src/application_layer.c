@@ -1,196 +1,1395 @@
 // Application layer protocol implementation
 
+#define _GNU_SOURCE
+
 #include "application_layer.h"
 #include "link_layer.h"
+#include "bond.h"
+#include "chunk_pipeline.h"
+#include "channel.h"
+#include "checksum.h"
+#include "compression.h"
+#include "delta.h"
+#include "duplex.h"
+#include "journal.h"
+#include "link_session.h"
+#include "options.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define TYPE_START 0x01
 #define TYPE_END 0x03
 #define TYPE_DATA 0x02
+#define TYPE_DATA_COMPRESSED 0x04
+#define TYPE_SIGNATURES 0x05
+#define TYPE_COPY 0x06
+#define TYPE_RESUME 0x07
+#define TYPE_SESSION_END 0x08
+#define TYPE_MESSAGE 0x09
+
 #define FILE_SIZE 0x00
+#define FILE_NAME 0x01
+#define DELTA_BLOCK 0x02
+#define RESUME_OFFSET 0x03
+#define FILE_CHECKSUM 0x04
 
-void applicationLayer(const char *serialPort, const char *role, int baudRate, int nTries, int timeout, const char *filename) {
+// DATA packet: DATA_HEADER_SIZE bytes of header (see chunk_pipeline.h), then a
+// payload of up to CHUNK_SIZE bytes. Like every packet, it fits in
+// MAX_PAYLOAD_SIZE.
 
-    LinkLayer info;
+// COPY packet: type, file offset, first block (4 bytes), block count (4 bytes).
+#define COPY_PACKET_SIZE (1 + OFFSET_SIZE + 8)
 
-    strcpy(info.serialPort, serialPort);
-    info.baudRate = baudRate;
-    info.nRetransmissions = nTries;
-    info.timeout = timeout;
+// SIGNATURES packet: type, index of its first block (4 bytes), number of
+// signatures (0 ends the list), then a weak (4 bytes) and strong (8 bytes)
+// checksum per block.
+#define SIGNATURES_HEADER_SIZE 6
+#define SIGNATURE_SIZE 12
+#define SIGNATURES_PER_PACKET ((MAX_PAYLOAD_SIZE - SIGNATURES_HEADER_SIZE) / SIGNATURE_SIZE)
 
-    if (!strcmp(role, "tx")) {
-        info.role = LlTx;
-    } else {
-        info.role = LlRx;
+// MESSAGE packet: type, logical channel, text size (2 bytes), text (one line,
+// without its newline).
+#define MESSAGE_HEADER_SIZE 4
+
+// Logical channels sharing the link: file data is bulk, and messages go first.
+#define CHANNEL_BULK 0
+#define CHANNEL_MESSAGES 1
+
+// Largest block size a receiver accepts for delta transfers.
+#define MAX_DELTA_BLOCK_SIZE 65535
+
+typedef struct {
+    size_t fileSize;
+    int stream;         // TRUE if the file size is not known yet (not sent)
+    int hasChecksum;
+    unsigned int checksum; // CRC-32C of the file bytes sent
+    int deltaBlockSize; // 0 if the transmitter does not request a delta transfer
+    int resume;         // TRUE if resumeOffset is present (always 0 in START)
+    size_t resumeOffset;
+    char fileName[256]; // Empty if absent
+} ControlInfo;
+
+typedef struct {
+    unsigned int packetNum;
+    size_t literalBytes;
+    size_t copiedBytes;
+} DeltaTransmission;
+
+static void putBytes(unsigned char *dst, unsigned long long value, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = (value >> (8 * (n - 1 - i))) & 0xFF;
     }
+}
 
+static unsigned long long getBytes(const unsigned char *src, int n) {
+    unsigned long long value = 0;
 
-    if (llopen(info) < 0) {
-        printf("Failed to open connection\n");
+    for (int i = 0; i < n; i++) {
+        value = (value << 8) | src[i];
+    }
+
+    return value;
+}
+
+// Append a TLV carrying value in as few bytes as it needs (1 to 8).
+static int putSizeTLV(unsigned char *packet, int n, unsigned char type, unsigned long long value) {
+    int length = 1;
+
+    while (length < 8 && (value >> (8 * length)) != 0) {
+        length++;
+    }
+
+    packet[n++] = type;
+    packet[n++] = length;
+    putBytes(packet + n, value, length);
+
+    return n + length;
+}
+
+// TRUE while the transmitter sends messages next to its files.
+static int messaging = FALSE;
+
+// Frames submitted to the link at once: one waiting for its acknowledgement
+// and one ready to go as soon as it arrives
+#define WRITE_QUEUE_DEPTH 2
+
+// A frame submitted by linkWritePacket() ran out of retries
+static int writeFailed = FALSE;
+
+static void packetWritten(LinkSession *session, int result, void *context) {
+    (void)session;
+    (void)context;
+
+    if (result < 0) {
+        writeFailed = TRUE;
+    }
+}
+
+// Send packet on the link, or on any of the bonded links. Returns once it is
+// queued, so the next packet is read (and compressed) while it is on the wire.
+static int linkWritePacket(const unsigned char *packet, int size) {
+    if (options.duplex) {
+        return llwrite(packet, size);
+    }
+
+    if (options.nBondPorts == 0) {
+        LinkSession *link = linkDefault();
+
+        while (!writeFailed && linkPending(link) >= WRITE_QUEUE_DEPTH) {
+            linkPoll(link, -1);
+        }
+
+        if (writeFailed || linkSubmit(link, packet, size, packetWritten, NULL) < 0) {
+            return -1;
+        }
+        return size;
+    }
+
+    int result = bondWrite(packet, size);
+
+    // Messages carry no sequence number, so each one is acknowledged before
+    // the next can take a faster link
+    if (result >= 0 && packet[0] == TYPE_MESSAGE && bondFlush() < 0) {
+        return -1;
+    }
+
+    return result;
+}
+
+// Send a packet of file data, after the messages already queued.
+static int writePacket(const unsigned char *packet, int size) {
+    if (messaging) {
+        return channelSend(CHANNEL_BULK, packet, size);
+    }
+
+    return linkWritePacket(packet, size);
+}
+
+// Queue each line of options.messages as a MESSAGE packet, until the end of
+// the file or of the session.
+static void *messageSourceThread(void *arg) {
+    (void)arg;
+
+    FILE *source = fopen(options.messages, "r");
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    char *text = (char *)packet + MESSAGE_HEADER_SIZE;
+    int maxText = MAX_PAYLOAD_SIZE - MESSAGE_HEADER_SIZE;
+
+    if (!source) {
+        perror(options.messages);
+        return NULL;
+    }
+
+    packet[0] = TYPE_MESSAGE;
+    packet[1] = CHANNEL_MESSAGES;
+
+    // Longer lines are sent as several messages
+    while (fgets(text, maxText, source)) {
+        int size = strcspn(text, "\n");
+
+        putBytes(packet + 2, size, 2);
+
+        if (channelQueue(CHANNEL_MESSAGES, packet, size + MESSAGE_HEADER_SIZE) < 0) {
+            break;
+        }
+    }
+
+    fclose(source);
+    return NULL;
+}
+
+// Share the link between file data and the messages read from
+// options.messages by a thread of their own.
+static int startMessages() {
+    pthread_t source;
+
+    if (channelsStart(2, linkWritePacket) < 0) {
+        return -1;
+    }
+
+    if (pthread_create(&source, NULL, messageSourceThread, NULL) != 0) {
+        channelsStop();
+        return -1;
+    }
+
+    pthread_detach(source);
+    messaging = TRUE;
+    return 0;
+}
+
+// Send a packet that must not overtake, or be overtaken by, the packets
+// around it. Bonded links deliver packets in any order, so those have to be
+// acknowledged first.
+static int writeInOrder(const unsigned char *packet, int size) {
+    // Messages already queued go first
+    if (messaging && channelFlush() < 0) {
+        return -1;
+    }
+
+    // Frames are sent in the order submitted, so this waits for those too
+    if (options.nBondPorts == 0) {
+        return writeFailed ? -1 : llwrite(packet, size);
+    }
+
+    return bondFlush() < 0 || bondWrite(packet, size) < 0 || bondFlush() < 0 ? -1 : size;
+}
+
+// Where received messages go (options.messages), opened with the first one.
+static FILE *messageSink = NULL;
+static unsigned int nMessages = 0;
+
+// Hand the text of a MESSAGE packet to options.messages, or print it.
+static void deliverMessage(const unsigned char *packet, int n) {
+
+    if (n < MESSAGE_HEADER_SIZE || (int)getBytes(packet + 2, 2) > n - MESSAGE_HEADER_SIZE) {
+        printf("Error receiving message packet\n");
         return;
     }
 
+    int size = getBytes(packet + 2, 2);
+    const char *text = (const char *)packet + MESSAGE_HEADER_SIZE;
+
+    if (options.messages && !messageSink) {
+        messageSink = fopen(options.messages, "a");
+
+        if (!messageSink) {
+            perror(options.messages);
+        }
+    }
+
+    if (messageSink) {
+        fprintf(messageSink, "%.*s\n", size, text);
+        fflush(messageSink);
+    } else {
+        printf("\nMessage on channel %d: %.*s\n", packet[1], size, text);
+    }
+
+    nMessages++;
+}
+
+// Read the next packet, waiting for the retransmission of rejected frames.
+// Messages arriving in between are delivered on the way.
+// Return its size, or "-1" if the link is gone.
+static int readPacket(unsigned char *packet) {
+    int bytesRead;
+
+    while (TRUE) {
+        while ((bytesRead = options.nBondPorts > 0 ? bondRead(packet) : llread(packet)) < 0) {
+            if (bytesRead == LINK_BROKEN) {
+                return -1;
+            }
+            printf("Waiting for retransmission...\n");
+        }
+
+        if (packet[0] != TYPE_MESSAGE) {
+            return bytesRead;
+        }
+
+        deliverMessage(packet, bytesRead);
+    }
+}
+
+static int sendControlPacket(unsigned char type, const ControlInfo *ctrl) {
+    unsigned char CTRLpacket[MAX_PAYLOAD_SIZE];
+    int n = 0;
+
+    CTRLpacket[n++] = type;
+
+    if (!ctrl->stream) {
+        n = putSizeTLV(CTRLpacket, n, FILE_SIZE, ctrl->fileSize);
+    }
+
+    if (ctrl->fileName[0] != '\0') {
+        int length = strlen(ctrl->fileName);
+
+        CTRLpacket[n++] = FILE_NAME;
+        CTRLpacket[n++] = length;
+        memcpy(CTRLpacket + n, ctrl->fileName, length);
+        n += length;
+    }
+
+    if (ctrl->deltaBlockSize > 0) {
+        CTRLpacket[n++] = DELTA_BLOCK;
+        CTRLpacket[n++] = 2;
+        putBytes(CTRLpacket + n, ctrl->deltaBlockSize, 2);
+        n += 2;
+    }
+
+    if (ctrl->resume) {
+        n = putSizeTLV(CTRLpacket, n, RESUME_OFFSET, ctrl->resumeOffset);
+    }
+
+    if (ctrl->hasChecksum) {
+        CTRLpacket[n++] = FILE_CHECKSUM;
+        CTRLpacket[n++] = 4;
+        putBytes(CTRLpacket + n, ctrl->checksum, 4);
+        n += 4;
+    }
+
+    return writeInOrder(CTRLpacket, n);
+}
+
+// Parse the n-byte control packet CTRLpacket into ctrl. A packet without
+// FILE_SIZE belongs to a stream of unknown size.
+// Return its type, or "-1" if it is not a well-formed control packet.
+static int parseControlPacket(const unsigned char *CTRLpacket, int n, ControlInfo *ctrl) {
+
+    if (n < 1) {
+        return -1;
+    }
+
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->stream = TRUE;
+
+    for (int i = 1; i + 2 <= n; i += 2 + CTRLpacket[i + 1]) {
+        const unsigned char *value = CTRLpacket + i + 2;
+        int length = CTRLpacket[i + 1];
+
+        if (i + 2 + length > n) {
+            return -1;
+        }
+
+        // Sizes and offsets take up to 8 bytes, everything else up to 4
+        if (CTRLpacket[i] != FILE_NAME && length > ((CTRLpacket[i] == FILE_SIZE || CTRLpacket[i] == RESUME_OFFSET) ? 8 : 4)) {
+            return -1;
+        }
+
+        switch (CTRLpacket[i]) {
+            case FILE_SIZE:
+                ctrl->fileSize = getBytes(value, length);
+                ctrl->stream = FALSE;
+                break;
+            case FILE_NAME:
+                memcpy(ctrl->fileName, value, length);
+                ctrl->fileName[length] = '\0';
+                break;
+            case DELTA_BLOCK:
+                ctrl->deltaBlockSize = getBytes(value, length);
+                break;
+            case RESUME_OFFSET:
+                ctrl->resume = TRUE;
+                ctrl->resumeOffset = getBytes(value, length);
+                break;
+            case FILE_CHECKSUM:
+                ctrl->hasChecksum = TRUE;
+                ctrl->checksum = getBytes(value, length);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return CTRLpacket[0];
+}
+
+// Read the next control packet into ctrl.
+// Return its type, or "-1" if it is not a well-formed control packet.
+static int readControlPacket(ControlInfo *ctrl) {
+    unsigned char CTRLpacket[MAX_PAYLOAD_SIZE];
+
+    int n = readPacket(CTRLpacket);
+
+    return parseControlPacket(CTRLpacket, n, ctrl);
+}
+
+static int receiveControlPacket(unsigned char type, ControlInfo *ctrl) {
+    return readControlPacket(ctrl) == type ? 0 : -1;
+}
+
+// Send size bytes of data, to be placed at offset of the file.
+static int sendDataPacket(unsigned char type, size_t offset, const unsigned char *data, int size) {
+    unsigned char DATApacket[MAX_PAYLOAD_SIZE];
+
+    DATApacket[0] = type;
+    putBytes(DATApacket + 1, offset, OFFSET_SIZE);
+    putBytes(DATApacket + 1 + OFFSET_SIZE, size, 2);
+
+    memcpy(DATApacket + DATA_HEADER_SIZE, data, size);
+
+    return writePacket(DATApacket, size + DATA_HEADER_SIZE);
+}
+
+////////////////////////////////////////////////
+// TRANSMITTER
+////////////////////////////////////////////////
+
+// Continue checksum over the first offset bytes of file, leaving it at offset.
+// Return "0" on success or "-1" if the file is shorter.
+static int checksumPrefix(FILE *file, size_t offset, unsigned int *checksum) {
+    unsigned char buffer[CHUNK_SIZE];
+
+    rewind(file);
+
+    while (offset > 0) {
+        size_t n = fread(buffer, 1, offset < sizeof(buffer) ? offset : sizeof(buffer), file);
+
+        if (n == 0) {
+            return -1;
+        }
+
+        *checksum = crc32c(*checksum, buffer, n);
+        offset -= n;
+    }
+
+    return 0;
+}
+
+// Wait for the pipeline's next chunk. Messages queued meanwhile go out on
+// their own instead of waiting for it (e.g., while the standard input is idle).
+static int nextChunk(Chunk *chunk) {
+    if (!messaging) {
+        return pipelineNext(chunk);
+    }
+
+    channelIdle();
+    int result = pipelineNext(chunk);
+    channelBusy();
+
+    return result;
+}
+
+// Send the rest of the file, from offset, in chunks compressed ahead of time
+// by the pipeline. checksum holds the CRC-32C of the bytes before offset and
+// is continued over the bytes sent.
+// Return the number of file bytes sent, or "-1" on error.
+static long long sendFileChunks(FILE *file, size_t offset, unsigned int *checksum) {
+
+    if (pipelineStart(file, options.compress, options.compressThreads, *checksum) < 0) {
+        return -1;
+    }
+
+    unsigned int packetNum = 0;
+    int chunkResult = 0;
+    size_t bytesRead = 0;
+    size_t bytesSent = 0;
+    Chunk chunk;
+
+    while ((chunkResult = nextChunk(&chunk)) > 0) {
+        printf("\nCurrent packet's number: %u\n", packetNum);
+
+        if (sendDataPacket(chunk.compressed ? TYPE_DATA_COMPRESSED : TYPE_DATA, offset + bytesRead, chunk.data, chunk.size) < 0) {
+            printf("Error sending data packet\n");
+            pipelineStop();
+            return -1;
+        }
+
+        bytesRead += chunk.rawSize;
+        bytesSent += chunk.size;
+        packetNum++;
+    }
+
+    *checksum = pipelineChecksum();
+    pipelineStop();
+
+    if (chunkResult < 0) {
+        printf("Error reading file\n");
+        return -1;
+    }
+
+    if (options.compress) {
+        printf("\nCompressed %zu bytes into %zu bytes using %d threads\n", bytesRead, bytesSent, options.compressThreads);
+    }
+
+    return bytesRead;
+}
 
-    if (info.role == LlTx) {
+// Receive the signatures of the blocks the receiver already has.
+static int receiveSignatures(BlockSignature **sigs, int *nSigs) {
+    unsigned char packet[MAX_PAYLOAD_SIZE];
 
-        FILE *file = fopen(filename, "rb");
+    *sigs = NULL;
+    *nSigs = 0;
 
-        if (!file) {
-            printf("Failed to open file for reading\n");
-            llclose(1);
-            return;
+    while (TRUE) {
+        int n = readPacket(packet);
+
+        if (n < SIGNATURES_HEADER_SIZE || packet[0] != TYPE_SIGNATURES || getBytes(packet + 1, 4) != (unsigned int)*nSigs) {
+            printf("Error receiving block signatures\n");
+            free(*sigs);
+            return -1;
+        }
+
+        int count = packet[5];
+
+        if (count == 0) {
+            return 0;
         }
 
-        fseek(file, 0, SEEK_END);
-        size_t f_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
+        if (n < SIGNATURES_HEADER_SIZE + count * SIGNATURE_SIZE) {
+            printf("Error receiving block signatures\n");
+            free(*sigs);
+            return -1;
+        }
 
-        unsigned char CTRLpacket_START[MAX_PAYLOAD_SIZE] = {0};
+        BlockSignature *grown = realloc(*sigs, (*nSigs + count) * sizeof(BlockSignature));
 
-        CTRLpacket_START[0] = TYPE_START;
-        CTRLpacket_START[1] = FILE_SIZE;
-        CTRLpacket_START[2] = 4;
+        if (!grown) {
+            free(*sigs);
+            return -1;
+        }
+        *sigs = grown;
 
-        CTRLpacket_START[3] = f_size >> 24;
-        CTRLpacket_START[4] = (f_size >> 16) & 0xFF;
-        CTRLpacket_START[5] = (f_size >> 8) & 0xFF;
-        CTRLpacket_START[6] = f_size & 0xFF;
+        for (int i = 0; i < count; i++) {
+            const unsigned char *entry = packet + SIGNATURES_HEADER_SIZE + i * SIGNATURE_SIZE;
 
-        printf("Sending START control packet...\n");
+            (*sigs)[*nSigs].weak = getBytes(entry, 4);
+            (*sigs)[*nSigs].strong = getBytes(entry + 4, 8);
+            (*nSigs)++;
+        }
+    }
+}
+
+static int sendLiteral(void *ctx, const unsigned char *data, int size) {
+    DeltaTransmission *tx = ctx;
+    unsigned char compressed[CHUNK_SIZE];
+    size_t offset = tx->literalBytes + tx->copiedBytes;
+
+    printf("\nCurrent packet's number: %u\n", tx->packetNum);
+
+    int compressedSize = options.compress ? compressChunk(data, size, compressed, size - 1) : -1;
+    int result;
+
+    if (compressedSize > 0) {
+        result = sendDataPacket(TYPE_DATA_COMPRESSED, offset, compressed, compressedSize);
+    } else {
+        result = sendDataPacket(TYPE_DATA, offset, data, size);
+    }
 
-        if ((llwrite(CTRLpacket_START, 7) < 0)) {
-            printf("Error sending control packet START\n");
+    if (result < 0) {
+        printf("Error sending data packet\n");
+        return -1;
+    }
+
+    tx->literalBytes += size;
+    tx->packetNum++;
+    return 0;
+}
+
+static int sendCopy(void *ctx, unsigned int firstBlock, unsigned int count) {
+    DeltaTransmission *tx = ctx;
+    unsigned char COPYpacket[COPY_PACKET_SIZE];
+
+    printf("\nCurrent packet's number: %u (copy of %u blocks)\n", tx->packetNum, count);
+
+    COPYpacket[0] = TYPE_COPY;
+    putBytes(COPYpacket + 1, tx->literalBytes + tx->copiedBytes, OFFSET_SIZE);
+    putBytes(COPYpacket + 1 + OFFSET_SIZE, firstBlock, 4);
+    putBytes(COPYpacket + 5 + OFFSET_SIZE, count, 4);
+
+    if (writePacket(COPYpacket, sizeof(COPYpacket)) < 0) {
+        printf("Error sending copy packet\n");
+        return -1;
+    }
+
+    tx->copiedBytes += (size_t)count * DELTA_BLOCK_SIZE;
+    tx->packetNum++;
+    return 0;
+}
+
+// Send only the parts of the file the receiver doesn't already have, and
+// store the CRC-32C of the whole file in checksum.
+static int sendFileDelta(FILE *file, size_t f_size, unsigned int *checksum) {
+    BlockSignature *sigs;
+    int nSigs;
+
+    if (receiveSignatures(&sigs, &nSigs) < 0) {
+        return -1;
+    }
+
+    printf("Received signatures of %d blocks from the receiver\n", nSigs);
+
+    unsigned char *data = NULL;
+
+    if (f_size > 0) {
+        data = mmap(NULL, f_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            free(sigs);
+            return -1;
+        }
+    }
+
+    *checksum = crc32c(CRC32C_INIT, data, f_size);
+
+    DeltaTransmission tx = {0, 0, 0};
+    DeltaEmitter emitter = {sendLiteral, sendCopy, &tx};
+
+    int result = deltaScan(data, f_size, sigs, nSigs, DELTA_BLOCK_SIZE, CHUNK_SIZE, &emitter);
+
+    if (data) {
+        munmap(data, f_size);
+    }
+    free(sigs);
+
+    if (result == 0) {
+        printf("\nDelta transfer: %zu bytes sent, %zu bytes reused from the receiver's file\n", tx.literalBytes, tx.copiedBytes);
+    }
+
+    return result;
+}
+
+// Send one file of the session ("-" for the standard input). Return its size,
+// or "-1" if it couldn't be opened (and was skipped).
+static long long transmitFile(const char *filename) {
+
+    int fromStdin = !strcmp(filename, "-");
+    FILE *file = fromStdin ? stdin : fopen(filename, "rb");
+
+    if (!file) {
+        printf("Failed to open file %s for reading\n", filename);
+        return -1;
+    }
+
+    // Pipes, sockets and the like are streamed: their size is only known at the end
+    struct stat st;
+    int stream = fstat(fileno(file), &st) < 0 || !S_ISREG(st.st_mode);
+    size_t f_size = stream ? 0 : st.st_size;
+
+    ControlInfo ctrl = {
+        .fileSize = f_size,
+        .stream = stream,
+        .deltaBlockSize = options.delta && !stream ? DELTA_BLOCK_SIZE : 0,
+        .resume = options.resume && !options.delta && !stream,
+        .resumeOffset = 0,
+        .checksum = CRC32C_INIT,
+    };
+
+    if (stream && (options.delta || options.resume)) {
+        printf("Streaming %s, --delta and --resume don't apply\n", filename);
+    }
+
+    // Only the name itself, the receiver decides the directory
+    const char *name = strrchr(filename, '/');
+    snprintf(ctrl.fileName, sizeof(ctrl.fileName), "%s", fromStdin ? "stdin" : name ? name + 1 : filename);
+
+    printf("Sending START control packet...\n");
+
+    if (sendControlPacket(TYPE_START, &ctrl) < 0) {
+        printf("Error sending control packet START\n");
+        fclose(file);
+        exit(-1);
+    } else {
+        printf("Control packet START sent successfully!\n");
+    }
+
+    size_t offset = 0;
+
+    if (ctrl.resume) {
+        ControlInfo reply;
+
+        if (receiveControlPacket(TYPE_RESUME, &reply) < 0 || reply.resumeOffset > f_size) {
+            printf("Error receiving control packet RESUME\n");
             fclose(file);
             exit(-1);
-        } else {
-            printf("Control packet START sent successfully!\n");
         }
 
-        int packetNum = 0;
-        int bytesReadFromFile = 0;
-        unsigned char temp[MAX_PAYLOAD_SIZE] = {0};
+        offset = reply.resumeOffset;
 
-        while ((bytesReadFromFile = fread(temp, 1, MAX_PAYLOAD_SIZE, file)) > 0) {
-            printf("\nCurrent packet's number: %d\n", packetNum);
+        // The checksum in END still covers the whole file
+        if (checksumPrefix(file, offset, &ctrl.checksum) < 0) {
+            printf("Error reading the first %zu bytes of %s\n", offset, filename);
+            fclose(file);
+            exit(-1);
+        }
 
-            unsigned char DATApacket[MAX_PAYLOAD_SIZE + 4];
+        if (offset > 0) {
+            printf("Receiver already has %zu bytes, resuming from there\n", offset);
+        }
+    }
 
-            DATApacket[0] = TYPE_DATA;
-            DATApacket[1] = packetNum;
-            DATApacket[2] = (bytesReadFromFile >> 8) & 0xFF;
-            DATApacket[3] = bytesReadFromFile & 0xFF;
+    if (ctrl.deltaBlockSize > 0) {
+        if (sendFileDelta(file, f_size, &ctrl.checksum) < 0) {
+            fclose(file);
+            exit(-1);
+        }
+    } else {
+        long long bytesSent = sendFileChunks(file, offset, &ctrl.checksum);
 
-            for (int i = 0; i < bytesReadFromFile; i++) {
-                DATApacket[4 + i] = temp[i];
+        if (bytesSent < 0) {
+            fclose(file);
+            exit(-1);
+        }
+
+        // END tells the receiver how much a stream turned out to carry
+        if (stream) {
+            f_size = bytesSent;
+            ctrl.fileSize = f_size;
+            ctrl.stream = FALSE;
+        }
+    }
+
+    // END carries the size and checksum the receiver checks the file against
+    ctrl.hasChecksum = TRUE;
+
+    printf("\nSending END control packet...\n");
+
+    if (sendControlPacket(TYPE_END, &ctrl) < 0) {
+        printf("Error sending control packet END\n");
+        fclose(file);
+        exit(-1);
+    } else {
+        printf("\nControl packet END sent successfully!\n");
+    }
+
+    printf("\nFile transmission successful!\n");
+    fclose(file);
+    return f_size;
+}
+
+////////////////////////////////////////////////
+// RECEIVER
+////////////////////////////////////////////////
+
+// Sign each full block of the receiver's copy of the file (if any) for the
+// transmitter, ending with an empty SIGNATURES packet.
+static int sendSignatures(FILE *old, int blockSize) {
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    unsigned char *block = malloc(blockSize);
+    unsigned int nSigs = 0;
+    int count = 0;
+
+    if (!block) {
+        return -1;
+    }
+
+    while (TRUE) {
+        int full = old && fread(block, 1, blockSize, old) == (size_t)blockSize;
+
+        if (full) {
+            unsigned char *entry = packet + SIGNATURES_HEADER_SIZE + count * SIGNATURE_SIZE;
+
+            putBytes(entry, weakChecksum(block, blockSize), 4);
+            putBytes(entry + 4, strongChecksum(block, blockSize), 8);
+            count++;
+        }
+
+        // Flush full packets, the remaining signatures and finally the empty one
+        if (count == SIGNATURES_PER_PACKET || !full) {
+            packet[0] = TYPE_SIGNATURES;
+            putBytes(packet + 1, nSigs, 4);
+            packet[5] = count;
+
+            if (llwrite(packet, SIGNATURES_HEADER_SIZE + count * SIGNATURE_SIZE) < 0) {
+                printf("Error sending block signatures\n");
+                free(block);
+                return -1;
             }
 
-            if (llwrite(DATApacket, bytesReadFromFile + 4) < 0) {
-                printf("Error sending data packet\n");
-                fclose(file);
-                exit(-1);
+            nSigs += count;
+
+            if (count == 0) {
+                break;
             }
+            count = 0;
+        }
+    }
 
-            packetNum++;
+    printf("Sent signatures of %u blocks to the transmitter\n", nSigs);
+    free(block);
+    return 0;
+}
+
+// Data that reached a sequential file ahead of the bytes before it, held
+// until those are written.
+typedef struct HeldData {
+    struct HeldData *next;
+    size_t offset;
+    size_t size;
+    unsigned char data[];
+} HeldData;
+
+// Where the receiver places the data of the file being received.
+typedef struct {
+    FILE *file;
+    int sequential;       // TRUE if file can only be appended to (the standard output)
+    size_t end;           // End of the furthest data placed so far
+    size_t checksummed;   // Bytes at the start of the file covered by checksum
+    unsigned int checksum;
+    int outOfOrder;       // TRUE if data landed past checksummed, so END re-reads the file
+    HeldData *held;       // Data past end of a sequential file, sorted by offset
+} Placement;
+
+// Keep a copy of data, which belongs past the end of a sequential file.
+static int holdData(Placement *out, size_t offset, const unsigned char *data, size_t size) {
+    HeldData *held = malloc(sizeof(HeldData) + size);
+    HeldData **next = &out->held;
+
+    if (!held) {
+        return -1;
+    }
+
+    held->offset = offset;
+    held->size = size;
+    memcpy(held->data, data, size);
+
+    while (*next && (*next)->offset < offset) {
+        next = &(*next)->next;
+    }
+
+    held->next = *next;
+    *next = held;
+    return 0;
+}
+
+// Write size bytes of data at offset of the file. Placing data again (a
+// duplicate packet) leaves the file as it was.
+// Return "0" on success or "-1" on error.
+static int placeData(Placement *out, size_t offset, const unsigned char *data, size_t size) {
+
+    if (out->sequential) {
+        // Nothing can be skipped, so data arriving early (over bonded links) waits
+        if (offset > out->end) {
+            return holdData(out, offset, data, size);
+        }
+
+        // Only the bytes past the end are new
+        size_t skip = out->end - offset;
+
+        if (skip < size && fwrite(data + skip, 1, size - skip, out->file) != size - skip) {
+            return -1;
         }
+    } else if (pwrite(fileno(out->file), data, size, offset) != (ssize_t)size) {
+        return -1;
+    }
 
-        unsigned char CTRLpacket_END[MAX_PAYLOAD_SIZE] = {0};
+    if (offset <= out->checksummed && offset + size > out->checksummed) {
+        size_t skip = out->checksummed - offset;
+
+        out->checksum = crc32c(out->checksum, data + skip, size - skip);
+        out->checksummed = offset + size;
+    } else if (offset > out->checksummed) {
+        out->outOfOrder = TRUE;
+    }
 
-        CTRLpacket_END[0] = TYPE_END;
-        CTRLpacket_END[1] = FILE_SIZE;
-        CTRLpacket_END[2] = 4;
+    if (offset + size > out->end) {
+        out->end = offset + size;
+    }
 
-        CTRLpacket_END[3] = f_size >> 24;
-        CTRLpacket_END[4] = (f_size >> 16) & 0xFF;
-        CTRLpacket_END[5] = (f_size >> 8) & 0xFF;
-        CTRLpacket_END[6] = f_size & 0xFF;
+    while (out->held && out->held->offset <= out->end) {
+        HeldData *held = out->held;
+        out->held = held->next;
 
-        printf("\nSending END control packet...\n");
+        int result = placeData(out, held->offset, held->data, held->size);
+        free(held);
 
-        if ((llwrite(CTRLpacket_END, 7) < 0)) {
-            printf("Error sending control packet END\n");
-            fclose(file);
-            exit(-1);
-        } else {
-            printf("\nControl packet END sent successfully!\n");
+        if (result < 0) {
+            return -1;
         }
+    }
 
-        printf("\nFile transmission successful!\n");
-        fclose(file);
+    return 0;
+}
 
-    } else if (info.role == LlRx) {
+// Place count blocks of the old copy of the file, starting at firstBlock, at
+// offset. Return the number of bytes placed.
+static size_t copyBlocks(FILE *old, Placement *out, size_t offset, unsigned int firstBlock, unsigned int count, int blockSize) {
+    unsigned char *block = malloc(blockSize);
+    size_t copied = 0;
 
-        FILE *file = fopen(filename, "wb");
+    if (!block || fseeko(old, (off_t)firstBlock * blockSize, SEEK_SET) < 0) {
+        free(block);
+        return 0;
+    }
 
-        if (!file) {
-            printf("Failed to open file for writing\n");
-            llclose(1);
-            return;
+    for (unsigned int i = 0; i < count; i++) {
+        if (fread(block, 1, blockSize, old) != (size_t)blockSize || placeData(out, offset + copied, block, blockSize) < 0) {
+            break;
         }
+        copied += blockSize;
+    }
+
+    free(block);
+    return copied;
+}
 
-        size_t f_size = 0;
+// Standard output, where files go when the receiver's filename is "-".
+static FILE *dataOut = NULL;
 
-        unsigned char CTRLpacket_START[MAX_PAYLOAD_SIZE] = {0};
+// Files of the session whose checksum didn't match.
+static int nCorrupt = 0;
 
-        llread(CTRLpacket_START);
+// Receive the file announced by the START control packet ctrl into filename
+// ("-" for the standard output). The file ends when the END packet arrives, so
+// streams of unknown size are received the same way. Returns the file's size.
+static size_t receiveFile(ControlInfo ctrl, const char *filename) {
+
+    size_t f_size = ctrl.fileSize;
+    int toStdout = !strcmp(filename, "-");
+    printf("\nControl packet START received successfully!\n");
+
+    if (ctrl.stream) {
+        printf("Receiving a stream of unknown size\n");
+    }
+
+    FILE *old = NULL;
+    char tempName[PATH_MAX];
+    const char *outputName = filename;
+
+    if (ctrl.deltaBlockSize > 0) {
+        if (ctrl.deltaBlockSize > MAX_DELTA_BLOCK_SIZE) {
+            printf("Unsupported delta block size %d\n", ctrl.deltaBlockSize);
+            exit(-1);
+        }
 
-        if (CTRLpacket_START[0] != TYPE_START || CTRLpacket_START[1] != FILE_SIZE || CTRLpacket_START[2] != 4) {
-            printf("Error receiving the first bytes of control packet START\n");
+        // Rebuild the file next to the old copy, which it replaces at the end
+        if (!toStdout) {
+            old = fopen(filename, "rb");
+            snprintf(tempName, sizeof(tempName), "%s.delta", filename);
+            outputName = tempName;
+        }
+
+        if (sendSignatures(old, ctrl.deltaBlockSize) < 0) {
+            exit(-1);
+        }
+    }
+
+    // Continue after the bytes a previous transfer committed, if asked to
+    int journaled = ctrl.deltaBlockSize == 0 && !toStdout;
+    size_t offset = ctrl.resume && journaled ? journalLoad(filename, f_size) : 0;
+
+    FILE *file = toStdout ? dataOut : fopen(outputName, offset > 0 ? "r+b" : "w+b");
+
+    if (!file) {
+        printf("Failed to open file for writing\n");
+        return 0;
+    }
+
+    Placement out = {file, toStdout, offset, offset, CRC32C_INIT, FALSE, NULL};
+
+    if (offset > 0) {
+        // Drop whatever was written after the last checkpoint, and checksum
+        // the rest since END covers the whole file
+        if (ftruncate(fileno(file), offset) < 0 || checksumPrefix(file, offset, &out.checksum) < 0) {
+            perror("Failed to resume file");
             fclose(file);
             exit(-1);
         }
+        printf("Resuming reception at byte %zu\n", offset);
+    }
 
-        f_size = (CTRLpacket_START[3] << 24) | (CTRLpacket_START[4] << 16) | (CTRLpacket_START[5] << 8) | CTRLpacket_START[6];
-        printf("\nControl packet START received successfully!\n");
+    // Reserve the whole file up front, so packets can be placed anywhere in it
+    if (!toStdout && !ctrl.stream && f_size > offset &&
+        fallocate(fileno(file), 0, offset, f_size - offset) < 0 && errno != EOPNOTSUPP) {
+        perror("Failed to allocate file");
+        fclose(file);
+        exit(-1);
+    }
 
-        int packetNum = 0;
-        int bytesWrittenIntoNewFile = 0;
-        unsigned char temp[MAX_PAYLOAD_SIZE] = {0};
+    if (ctrl.resume) {
+        ControlInfo reply = {.fileSize = f_size, .resume = TRUE, .resumeOffset = offset};
 
-        while (bytesWrittenIntoNewFile < f_size) {
-            printf("\nCurrent packet's number: %d", packetNum);
+        if (sendControlPacket(TYPE_RESUME, &reply) < 0) {
+            printf("Error sending control packet RESUME\n");
+            fclose(file);
+            exit(-1);
+        }
+    }
+
+    if (journaled && journalOpen(filename, f_size) < 0) {
+        fclose(file);
+        exit(-1);
+    }
+
+    unsigned int packetNum = 0;
+    unsigned char temp[CHUNK_SIZE];
+    unsigned char DATApacket[MAX_PAYLOAD_SIZE];
+    int bytesReceived;
 
-            unsigned char DATApacket[MAX_PAYLOAD_SIZE + 4] = {0};
+    while (TRUE) {
+        printf("\nCurrent packet's number: %u", packetNum);
 
-            int bytesReceived = llread(DATApacket);
+        bytesReceived = readPacket(DATApacket);
+
+        if (bytesReceived > 0 && DATApacket[0] == TYPE_END) {
+            break;
+        }
 
-            if (DATApacket[0] != TYPE_DATA || DATApacket[1] != packetNum) {
-                printf("Error receiving data packet\n");
+        if (bytesReceived < DATA_HEADER_SIZE) {
+            printf("Error receiving data packet\n");
+            fclose(file);
+            exit(-1);
+        }
+
+        size_t dataOffset = getBytes(DATApacket + 1, OFFSET_SIZE);
+
+        if (DATApacket[0] == TYPE_COPY) {
+            unsigned int firstBlock = getBytes(DATApacket + 1 + OFFSET_SIZE, 4);
+            unsigned int count = getBytes(DATApacket + 5 + OFFSET_SIZE, 4);
+
+            if (!old || bytesReceived < COPY_PACKET_SIZE || copyBlocks(old, &out, dataOffset, firstBlock, count, ctrl.deltaBlockSize) != (size_t)count * ctrl.deltaBlockSize) {
+                printf("Error copying blocks from the old file\n");
                 fclose(file);
                 exit(-1);
             }
 
-            if (bytesReceived > 0) {
-                int p_size = DATApacket[2] * 256 + DATApacket[3];
+            packetNum++;
+            continue;
+        }
 
-                for (int i = 0; i < p_size; i++) {
-                    temp[i] = DATApacket[4 + i];
-                }
-                bytesWrittenIntoNewFile += fwrite(temp, 1, p_size, file);
+        int p_size = getBytes(DATApacket + 1 + OFFSET_SIZE, 2);
 
-                packetNum++;
-            }
+        if (p_size > bytesReceived - DATA_HEADER_SIZE) {
+            printf("Error receiving data packet\n");
+            fclose(file);
+            exit(-1);
         }
 
-        unsigned char CTRLpacket_END[MAX_PAYLOAD_SIZE] = {0};
+        if (DATApacket[0] == TYPE_DATA_COMPRESSED) {
+            p_size = decompressChunk(DATApacket + DATA_HEADER_SIZE, p_size, temp, sizeof(temp));
 
-        llread(CTRLpacket_END);
+            if (p_size < 0) {
+                printf("Error decompressing data packet\n");
+                fclose(file);
+                exit(-1);
+            }
+        } else if (DATApacket[0] == TYPE_DATA) {
+            memcpy(temp, DATApacket + DATA_HEADER_SIZE, p_size);
+        } else {
+            printf("Error receiving data packet\n");
+            fclose(file);
+            exit(-1);
+        }
 
-        if (CTRLpacket_END[0] != TYPE_END || CTRLpacket_END[1] != FILE_SIZE || CTRLpacket_END[2] != 4) {
-            printf("Error receiving the first bytes of control packet END\n");
+        if (placeData(&out, dataOffset, temp, p_size) < 0) {
+            perror("Failed to write data packet");
             fclose(file);
             exit(-1);
         }
 
-        f_size = (CTRLpacket_END[3] << 24) | (CTRLpacket_END[4] << 16) | (CTRLpacket_END[5] << 8) | CTRLpacket_END[6];
-        printf("\nControl packet END received successfully!\n\n");
+        packetNum++;
+
+        // Only the bytes before the first gap are safe to resume after
+        if (journaled && packetNum % JOURNAL_INTERVAL == 0) {
+            journalCommit(file, out.checksummed);
+        }
+    }
+
+    if (parseControlPacket(DATApacket, bytesReceived, &ctrl) != TYPE_END || ctrl.stream) {
+        printf("Error receiving the first bytes of control packet END\n");
+        fclose(file);
+        exit(-1);
+    }
+
+    printf("\nControl packet END received successfully!\n\n");
+
+    if (ctrl.fileSize != out.end) {
+        printf("Error: END announces %zu bytes but %zu were received\n", ctrl.fileSize, out.end);
+        exit(-1);
+    }
+
+    // The preallocated file might be longer if the file shrank while it was sent
+    if (!toStdout && ftruncate(fileno(file), out.end) < 0) {
+        perror("Failed to truncate file");
+        exit(-1);
+    }
 
-        printf("File reception successful!\n");
+    if (out.outOfOrder) {
+        out.checksum = CRC32C_INIT;
+        checksumPrefix(file, out.end, &out.checksum);
+    }
+
+    // A corrupted file is reported but the rest of the session still goes on
+    if (ctrl.hasChecksum && ctrl.checksum != out.checksum) {
+        printf("Error: checksum mismatch (sent %08X, received %08X)\n", ctrl.checksum, out.checksum);
+        nCorrupt++;
+    } else if (ctrl.hasChecksum) {
+        printf("Checksum %08X matches\n", out.checksum);
+    }
+
+    if (toStdout) {
+        fflush(file);
+    } else {
         fclose(file);
     }
 
+    if (journaled) {
+        journalClose(TRUE);
+    }
+
+    if (old) {
+        fclose(old);
+    }
+
+    if (outputName != filename && rename(outputName, filename) < 0) {
+        perror("rename");
+        exit(-1);
+    }
+
+    printf("File reception successful!\n");
+    return out.end;
+}
+
+// Choose where the index-th file of the session, transmitted as name, is stored:
+// inside target if it is a directory, as target itself for the first file, and
+// next to target under its own name for the others.
+static int outputPath(char *path, const char *target, const char *name, int index) {
+
+    if (!strcmp(target, "-")) {
+        snprintf(path, PATH_MAX, "-");
+        return 0;
+    }
+
+    if (name[0] == '\0' || strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+        if (index > 0) {
+            return -1;
+        }
+        name = NULL;
+    }
+
+    struct stat st;
+
+    if (stat(target, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (!name) {
+            return -1;
+        }
+        snprintf(path, PATH_MAX, "%s/%s", target, name);
+    } else if (index == 0 || !name) {
+        snprintf(path, PATH_MAX, "%s", target);
+    } else {
+        const char *slash = strrchr(target, '/');
+        int dirLength = slash ? slash - target + 1 : 0;
+        snprintf(path, PATH_MAX, "%.*s%s", dirLength, target, name);
+    }
+
+    return 0;
+}
+
+// Receive files until the transmitter ends the session.
+static void receiveSession(const char *target) {
+    ControlInfo ctrl;
+    char path[PATH_MAX];
+    int nFiles = 0;
+    size_t sessionBytes = 0;
+    int type;
+
+    if (!strcmp(target, "-")) {
+        // Keep the standard output for the data and send the messages to stderr
+        dataOut = fdopen(dup(STDOUT_FILENO), "wb");
+
+        if (!dataOut || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            perror("Failed to redirect the standard output");
+            exit(-1);
+        }
+    }
+
+    while ((type = readControlPacket(&ctrl)) == TYPE_START) {
+
+        if (outputPath(path, target, ctrl.fileName, nFiles) < 0) {
+            printf("Invalid file name in control packet START: \"%s\"\n", ctrl.fileName);
+            exit(-1);
+        }
+
+        printf("\nReceiving %s into %s\n", ctrl.fileName, path);
+        sessionBytes += receiveFile(ctrl, path);
+        nFiles++;
+    }
+
+    if (type != TYPE_SESSION_END) {
+        printf("Error receiving the first bytes of control packet START\n");
+        exit(-1);
+    }
+
+    if (ctrl.fileSize != sessionBytes) {
+        printf("Warning: transmitter sent %zu bytes in this session, received %zu\n", ctrl.fileSize, sessionBytes);
+    }
+
+    printf("\nSession complete: %d files, %zu bytes received\n", nFiles, sessionBytes);
+    if (nMessages > 0) {
+        printf("%u messages received\n", nMessages);
+    }
+
+    if (messageSink) {
+        fclose(messageSink);
+        messageSink = NULL;
+    }
+
+    if (nCorrupt > 0) {
+        printf("Warning: %d files don't match the transmitter's checksum\n", nCorrupt);
+    }
+}
+
+// Send filename (if not NULL) and the files given as options in one session.
+static void transmitSession(const char *filename) {
+    ControlInfo ctrl = {0};
+    int nFiles = 0;
+    int nSkipped = 0;
+
+    if (options.messages && startMessages() < 0) {
+        printf("Failed to start sending messages\n");
+        exit(-1);
+    }
+
+    for (int i = filename ? 0 : 1; i <= options.nFiles; i++) {
+        long long sent = transmitFile(i == 0 ? filename : options.files[i - 1]);
+
+        if (sent < 0) {
+            nSkipped++;
+        } else {
+            ctrl.fileSize += sent;
+            nFiles++;
+        }
+    }
+
+    // The receiver stops reading messages at SESSION END
+    if (messaging) {
+        channelsStop();
+        messaging = FALSE;
+    }
+
+    if (sendControlPacket(TYPE_SESSION_END, &ctrl) < 0) {
+        printf("Error sending control packet SESSION END\n");
+        exit(-1);
+    }
+
+    printf("\nSession complete: %d files, %zu bytes sent", nFiles, ctrl.fileSize);
+    if (nSkipped > 0) {
+        printf(" (%d files skipped)", nSkipped);
+    }
+    printf("\n");
+}
+
+static void *receiveSessionThread(void *target) {
+    receiveSession(target);
+    return NULL;
+}
+
+// Send sendFile (if not NULL) and the files given as options while receiving
+// the other end's files into target, one thread per direction.
+static void duplexSession(const char *sendFile, const char *target) {
+    pthread_t receiver;
+
+    // Their replies would travel against the other end's own files
+    if (options.delta || options.resume) {
+        printf("--delta and --resume don't apply to duplex sessions\n");
+        options.delta = FALSE;
+        options.resume = FALSE;
+    }
+
+    if (duplexStart() < 0) {
+        exit(-1);
+    }
+
+    if (pthread_create(&receiver, NULL, receiveSessionThread, (void *)target) != 0) {
+        printf("Failed to start the receiving thread\n");
+        exit(-1);
+    }
+
+    transmitSession(sendFile);
+    pthread_join(receiver, NULL);
+
+    duplexStop();
+}
+
+// The process side of --low-latency: keep its pages in memory so no page
+// fault delays a frame and, with a priority, run it (and the threads it
+// starts) ahead of normal processes, like the cable program does.
+static void startLowLatency() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("mlockall");
+    }
+
+    // Busy reads at a realtime priority would never let the other end run
+    if (options.rtPriority > 0 && options.vtime == 0 && sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        printf("--vtime=0 doesn't apply to realtime priorities on a single core\n");
+        options.vtime = 1;
+    }
+
+    if (options.rtPriority > 0) {
+        struct sched_param sp = {.sched_priority = options.rtPriority};
+
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+            perror("Could not set realtime priority");
+        }
+    }
+}
+
+void applicationLayer(const char *serialPort, const char *role, int baudRate, int nTries, int timeout, const char *filename) {
+
+    LinkLayer info;
+
+    strcpy(info.serialPort, serialPort);
+    info.baudRate = baudRate;
+    info.nRetransmissions = nTries;
+    info.timeout = timeout;
+
+    if (!strcmp(role, "tx")) {
+        info.role = LlTx;
+    } else {
+        info.role = LlRx;
+    }
+
+
+    // Only one thread may use a port's io_uring
+    if (options.ioUring && options.duplex) {
+        printf("--io-uring doesn't apply to duplex sessions\n");
+        options.ioUring = FALSE;
+    }
+
+    if (options.lowLatency) {
+        startLowLatency();
+    }
+
+    if (llopen(info) < 0) {
+        printf("Failed to open connection\n");
+        return;
+    }
+
+
+    if (options.nBondPorts > 0 && options.duplex) {
+        printf("--bond doesn't apply to duplex sessions\n");
+        options.nBondPorts = 0;
+    }
+
+    // Bonded links are driven by an event loop, which needs a file descriptor
+    if (options.nBondPorts > 0 && !strncmp(serialPort, "shm:", 4)) {
+        printf("--bond doesn't apply to shared-memory links\n");
+        options.nBondPorts = 0;
+    }
+
+    if (options.messages && options.duplex) {
+        printf("--messages doesn't apply to duplex sessions\n");
+        options.messages = NULL;
+    }
+
+    if (options.nBondPorts > 0) {
+        // The end of the block list must not overtake the signatures
+        if (options.delta) {
+            printf("--delta doesn't apply to bonded links\n");
+            options.delta = FALSE;
+        }
+
+        if (bondStart(info, options.bondPorts, options.nBondPorts) < 0) {
+            exit(-1);
+        }
+    }
+
+    if (options.duplex) {
+        // The receiver's filename is where its files go, it only sends the others
+        if (info.role == LlTx) {
+            duplexSession(filename, options.duplexTarget);
+        } else {
+            duplexSession(NULL, filename);
+        }
+    } else if (info.role == LlTx) {
+        transmitSession(filename);
+    } else if (info.role == LlRx) {
+        receiveSession(filename);
+    }
+
+    if (options.nBondPorts > 0) {
+        bondStop(TRUE);
+    }
+
 
     if (llclose(1) < 0) {
         printf("Error closing currently open connection\n");
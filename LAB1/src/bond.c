@@ -0,0 +1,552 @@
+// Link bonding implementation
+//
+// Every link runs stop-and-wait on its own, driven by one event loop. Each
+// frame goes to the link expected to deliver it first: the bytes already
+// queued on a link plus the frame, over the throughput measured on it. A link
+// only takes BOND_QUEUE_DEPTH frames at a time, so when the best link is full
+// bondWrite() waits for it instead of overloading a slower one. Packets are
+// handed to the receiver in the order they arrive; DATA packets carry their
+// file offset, so they don't need to arrive in order.
+//
+// A frame whose link goes down is sent again on another link. If only its
+// acknowledgement was lost the receiver gets it twice, so every frame starts
+// with a sequence number and the receiver drops the ones it has already seen.
+// Neither end keeps more than BOND_WINDOW numbers: the transmitter waits before
+// getting that far ahead of its oldest frame not acknowledged yet.
+//
+// Frames and received packets are kept in buffers big enough for any packet,
+// which go back to a free list once done with. bondStart() allocates as many
+// as the links keep queued, so the data path allocates nothing.
+
+#include "bond.h"
+#include "link_session.h"
+#include "link_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames queued on a link at once: one waiting for its acknowledgement and one
+// ready to go as soon as it arrives
+#define BOND_QUEUE_DEPTH 2
+
+// Seconds after which an idle link's rate is measured again, in case it changed
+#define PROBE_INTERVAL 1.0
+
+// Weight of the newest sample in a link's measured throughput
+#define RATE_SMOOTHING 0.2
+
+// Bytes of sequence number in front of every bonded packet
+#define BOND_HEADER_SIZE 4
+
+// Frames that may be sent past the oldest one not acknowledged yet
+#define BOND_WINDOW 4096
+
+typedef struct {
+    LinkSession *session;
+    const char *port;
+    int alive;
+    int open;
+
+    int queued;             // Frames queued on the link
+    size_t queuedBytes;
+    double rate;            // Measured throughput, in bytes per second
+    int measured;           // rate is measured, not just the line's nominal rate
+    double lastDone;        // When the last frame queued on it was acknowledged
+
+    unsigned int packets;
+    size_t bytes;
+} BondLink;
+
+// A frame given to bondWrite(), kept until it is acknowledged so it can be
+// sent again on another link.
+typedef struct BondFrame {
+    struct BondFrame *next;     // In spareFrames while not in use
+    BondLink *link;
+    double queuedAt;
+    unsigned int sequence;
+    int size;
+    unsigned char data[];
+} BondFrame;
+
+// A packet read on one of the links, waiting for bondRead().
+typedef struct BondPacket {
+    struct BondPacket *next;    // Or in sparePackets while not in use
+    int size;
+    unsigned char data[];
+} BondPacket;
+
+// Bytes of the buffer of a frame, or of a received packet: any packet fits
+#define FRAME_BUFFER_SIZE (sizeof(BondFrame) + BOND_HEADER_SIZE + MAX_PAYLOAD_SIZE)
+#define PACKET_BUFFER_SIZE (sizeof(BondPacket) + MAX_PAYLOAD_SIZE)
+
+// Sequence numbers marked so far: all of them before first, and those in the
+// window after it.
+typedef struct {
+    unsigned int first;
+    unsigned char marked[BOND_WINDOW / 8];
+} SequenceWindow;
+
+static LinkLayer parameters;
+static BondLink *links = NULL;
+static int nLinks = 0;
+static LinkLoop *loop = NULL;
+
+static int pending = 0;     // Frames given to bondWrite() not acknowledged yet
+static int failed = FALSE;  // Every link is down
+
+static BondPacket *receivedHead = NULL;
+static BondPacket *receivedTail = NULL;
+
+// Buffers not in use, see takeFrame() and takePacket()
+static BondFrame *spareFrames = NULL;
+static BondPacket *sparePackets = NULL;
+
+static unsigned int nextSequence = 0;   // Number of the next frame to send
+static SequenceWindow acknowledged;     // Frames the receiver acknowledged
+static SequenceWindow delivered;        // Packets handed to bondRead()
+
+static int isMarked(SequenceWindow *window, unsigned int sequence) {
+    return window->marked[sequence % BOND_WINDOW / 8] & (1 << sequence % 8);
+}
+
+// Mark sequence in window. Return FALSE if it already was, or if it's past the
+// window, which the transmitter never sends.
+static int markSequence(SequenceWindow *window, unsigned int sequence) {
+
+    if (sequence - window->first >= BOND_WINDOW || isMarked(window, sequence)) {
+        return FALSE;
+    }
+
+    window->marked[sequence % BOND_WINDOW / 8] |= 1 << sequence % 8;
+
+    while (isMarked(window, window->first)) {
+        window->marked[window->first % BOND_WINDOW / 8] &= ~(1 << window->first % 8);
+        window->first++;
+    }
+
+    return TRUE;
+}
+
+// Take a buffer for a frame of up to MAX_PAYLOAD_SIZE bytes of packet, one
+// given back by releaseFrame() if there is any. Return NULL on error.
+static BondFrame *takeFrame() {
+    BondFrame *frame = spareFrames;
+
+    if (!frame) {
+        return malloc(FRAME_BUFFER_SIZE);
+    }
+
+    spareFrames = frame->next;
+    return frame;
+}
+
+static void releaseFrame(BondFrame *frame) {
+    frame->next = spareFrames;
+    spareFrames = frame;
+}
+
+// Take a buffer for a received packet of up to MAX_PAYLOAD_SIZE bytes, one
+// given back by releasePacket() if there is any. Return NULL on error.
+static BondPacket *takePacket() {
+    BondPacket *packet = sparePackets;
+
+    if (!packet) {
+        return malloc(PACKET_BUFFER_SIZE);
+    }
+
+    sparePackets = packet->next;
+    return packet;
+}
+
+static void releasePacket(BondPacket *packet) {
+    packet->next = sparePackets;
+    sparePackets = packet;
+}
+
+// Return the live link expected to deliver size more bytes first, or NULL if
+// every link is down.
+static BondLink *bestLink(int size) {
+    BondLink *best = NULL;
+    double bestTime = 0;
+    double time = linkTime();
+
+    for (int i = 0; i < nLinks; i++) {
+        BondLink *link = &links[i];
+
+        if (!link->alive) {
+            continue;
+        }
+
+        // Try idle links before trusting their rates
+        if (link->queued == 0 && (!link->measured || time - link->lastDone > PROBE_INTERVAL)) {
+            return link;
+        }
+
+        double delivery = (link->queuedBytes + size) / link->rate;
+
+        if (!best || delivery < bestTime) {
+            best = link;
+            bestTime = delivery;
+        }
+    }
+
+    return best;
+}
+
+static void frameDone(LinkSession *session, int result, void *context);
+
+// Queue frame on link.
+static void queueFrame(BondLink *link, BondFrame *frame) {
+    frame->link = link;
+    frame->queuedAt = linkTime();
+
+    link->queued++;
+    link->queuedBytes += frame->size;
+
+    if (linkSubmit(link->session, frame->data, frame->size, frameDone, frame) < 0) {
+        frameDone(link->session, -1, frame);
+    }
+}
+
+static void frameDone(LinkSession *session, int result, void *context) {
+    BondFrame *frame = context;
+    BondLink *link = frame->link;
+    double time = linkTime();
+
+    link->queued--;
+    link->queuedBytes -= frame->size;
+
+    // Wake up bondWrite() or bondFlush()
+    loopStop(loop);
+
+    if (result >= 0) {
+        // The frame went out when the previous one was acknowledged, or when
+        // it was queued if the link was idle
+        double start = frame->queuedAt > link->lastDone ? frame->queuedAt : link->lastDone;
+
+        if (time > start) {
+            double rate = frame->size / (time - start);
+
+            link->rate = link->measured ? link->rate + RATE_SMOOTHING * (rate - link->rate) : rate;
+            link->measured = TRUE;
+        }
+
+        link->lastDone = time;
+        link->packets++;
+        link->bytes += frame->size;
+
+        markSequence(&acknowledged, frame->sequence);
+        pending--;
+        releaseFrame(frame);
+        return;
+    }
+
+    if (link->alive) {
+        printf("\nLink on %s is down, sending its frames on the others\n", link->port);
+        link->alive = FALSE;
+        loopRemove(loop, session);
+    }
+
+    BondLink *other = bestLink(frame->size);
+
+    if (!other) {
+        printf("Every bonded link is down\n");
+        failed = TRUE;
+        pending--;
+        releaseFrame(frame);
+        return;
+    }
+
+    queueFrame(other, frame);
+}
+
+static void packetReceived(LinkSession *session, const unsigned char *packet, int size, void *context) {
+    BondLink *link = context;
+    (void)session;
+
+    // Wouldn't fit in bondRead()'s packet
+    if (size < BOND_HEADER_SIZE || size - BOND_HEADER_SIZE > MAX_PAYLOAD_SIZE) {
+        printf("Dropping a bonded packet of %d bytes\n", size);
+        return;
+    }
+
+    unsigned int sequence = 0;
+    for (int i = 0; i < BOND_HEADER_SIZE; i++) {
+        sequence = sequence << 8 | packet[i];
+    }
+
+    link->packets++;
+    link->bytes += size;
+
+    // Sent again after the acknowledgement on another link was lost
+    if (!markSequence(&delivered, sequence)) {
+        return;
+    }
+
+    packet += BOND_HEADER_SIZE;
+    size -= BOND_HEADER_SIZE;
+
+    BondPacket *received = takePacket();
+
+    if (!received) {
+        printf("Out of memory for a received packet\n");
+        failed = TRUE;
+        loopStop(loop);
+        return;
+    }
+
+    received->next = NULL;
+    received->size = size;
+    memcpy(received->data, packet, size);
+
+    if (receivedTail) {
+        receivedTail->next = received;
+    } else {
+        receivedHead = received;
+    }
+    receivedTail = received;
+
+    loopStop(loop);
+}
+
+static int addLink(LinkSession *session, const char *port) {
+    BondLink *link = &links[nLinks];
+
+    memset(link, 0, sizeof(BondLink));
+    link->session = session;
+    link->port = port;
+    link->alive = TRUE;
+    link->open = TRUE;
+
+    // Until measured, assume the line's nominal rate (8N1: 10 bits per byte)
+    link->rate = parameters.baudRate / 10.0;
+
+    linkSetPacketHandler(session, packetReceived, link);
+
+    // A link that stops answering is dropped, its frames go to the others
+    linkSetReconnect(session, FALSE);
+    nLinks++;
+
+    return loopAdd(loop, session);
+}
+
+int bondStart(LinkLayer connectionParameters, char **ports, int nPorts) {
+
+    parameters = connectionParameters;
+    nextSequence = 0;
+    memset(&acknowledged, 0, sizeof(acknowledged));
+    memset(&delivered, 0, sizeof(delivered));
+
+    links = calloc(nPorts + 1, sizeof(BondLink));
+    loop = loopCreate();
+
+    if (!links || !loop || !linkDefault() || addLink(linkDefault(), parameters.serialPort) < 0) {
+        printf("Failed to start link bonding\n");
+        return -1;
+    }
+
+    for (int i = 0; i < nPorts; i++) {
+        LinkLayer extra = connectionParameters;
+        snprintf(extra.serialPort, sizeof(extra.serialPort), "%s", ports[i]);
+
+        printf("Opening bonded link on %s...\n", ports[i]);
+
+        LinkSession *session = linkOpen(extra);
+
+        if (!session) {
+            printf("Failed to open bonded link on %s\n", ports[i]);
+            return -1;
+        }
+
+        if (addLink(session, ports[i]) < 0) {
+            return -1;
+        }
+    }
+
+    // For the frames queued on every link, or the packets they bring
+    for (int i = 0; i < nLinks * BOND_QUEUE_DEPTH; i++) {
+        void *buffer = malloc(parameters.role == LlTx ? FRAME_BUFFER_SIZE : PACKET_BUFFER_SIZE);
+
+        if (!buffer) {
+            printf("Failed to start link bonding\n");
+            return -1;
+        }
+
+        if (parameters.role == LlTx) {
+            releaseFrame(buffer);
+        } else {
+            releasePacket(buffer);
+        }
+    }
+
+    printf("Striping frames over %d links\n", nLinks);
+    return 0;
+}
+
+int bondWrite(const unsigned char *buf, int bufSize) {
+
+    if (bufSize > MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    while (!failed) {
+        BondLink *link = bestLink(bufSize);
+
+        if (!link) {
+            return -1;
+        }
+
+        // Past the window the receiver couldn't tell a frame from one sent twice
+        if (link->queued < BOND_QUEUE_DEPTH && nextSequence - acknowledged.first < BOND_WINDOW) {
+            BondFrame *frame = takeFrame();
+
+            if (!frame) {
+                return -1;
+            }
+
+            frame->sequence = nextSequence++;
+            for (int i = 0; i < BOND_HEADER_SIZE; i++) {
+                frame->data[i] = frame->sequence >> 8 * (BOND_HEADER_SIZE - 1 - i);
+            }
+
+            frame->size = BOND_HEADER_SIZE + bufSize;
+            memcpy(frame->data + BOND_HEADER_SIZE, buf, bufSize);
+
+            pending++;
+            queueFrame(link, frame);
+            return failed ? -1 : bufSize;
+        }
+
+        // Wait for a frame to be acknowledged
+        if (loopRun(loop) < 0) {
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+int bondFlush() {
+
+    while (pending > 0 && !failed) {
+        if (loopRun(loop) < 0) {
+            return -1;
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+int bondRead(unsigned char *packet) {
+
+    while (!receivedHead) {
+        if (failed || loopRun(loop) < 0) {
+            return LINK_BROKEN;
+        }
+    }
+
+    BondPacket *received = receivedHead;
+    int size = received->size;
+
+    receivedHead = received->next;
+    if (!receivedHead) {
+        receivedTail = NULL;
+    }
+
+    memcpy(packet, received->data, size);
+    releasePacket(received);
+
+    return size;
+}
+
+// Wait for the transmitter to close each extra link, one after the other, and
+// answer it. Links it doesn't close in time are taken to be down.
+static void closeReceiverLinks() {
+    int nOpen = nLinks - 1;
+    double closeTime = parameters.timeout * parameters.nRetransmissions;
+
+    // The transmitter may spend closeTime on each link that went down
+    double deadline = linkTime() + closeTime * nOpen;
+
+    while (nOpen > 0 && linkTime() < deadline) {
+        loopRunFor(loop, 0.1);
+
+        for (int i = 1; i < nLinks; i++) {
+            if (links[i].open && linkClosing(links[i].session)) {
+                loopRemove(loop, links[i].session);
+                linkClose(links[i].session, FALSE);
+                links[i].open = FALSE;
+                nOpen--;
+
+                deadline = linkTime() + closeTime * nOpen;
+            }
+        }
+    }
+}
+
+void bondStop(int showStatistics) {
+
+    if (!loop) {
+        return;
+    }
+
+    if (parameters.role == LlRx) {
+        closeReceiverLinks();
+    }
+
+    for (int i = 0; i < nLinks; i++) {
+        loopRemove(loop, links[i].session);
+
+        // The first link is the one llclose() closes
+        if (i == 0 || !links[i].open) {
+            continue;
+        }
+
+        if (links[i].alive && parameters.role == LlTx) {
+            linkClose(links[i].session, FALSE);
+        } else {
+            printf("Closing bonded link on %s without the DISC handshake\n", links[i].port);
+            linkAbort(links[i].session);
+        }
+    }
+
+    if (showStatistics) {
+        printf("\n-----------------------------------------\n");
+        printf("Bonded links:\n\n");
+
+        for (int i = 0; i < nLinks; i++) {
+            printf("%s: %u packets, %zu bytes", links[i].port, links[i].packets, links[i].bytes);
+
+            if (parameters.role == LlTx) {
+                printf(", %.0f B/s%s", links[i].rate, links[i].alive ? "" : " (down)");
+            }
+            printf("\n");
+        }
+        printf("\n-----------------------------------------\n");
+    }
+
+    while (receivedHead) {
+        BondPacket *next = receivedHead->next;
+        releasePacket(receivedHead);
+        receivedHead = next;
+    }
+    receivedTail = NULL;
+
+    while (spareFrames) {
+        BondFrame *next = spareFrames->next;
+        free(spareFrames);
+        spareFrames = next;
+    }
+
+    while (sparePackets) {
+        BondPacket *next = sparePackets->next;
+        free(sparePackets);
+        sparePackets = next;
+    }
+
+    loopDestroy(loop);
+    loop = NULL;
+    free(links);
+    links = NULL;
+    nLinks = 0;
+}
@@ -0,0 +1,304 @@
+// Logical channel scheduler implementation
+//
+// The thread writing to the link sends packets in channelSend() and
+// channelFlush(), holding linkLock the whole time except while it waits for
+// something else (channelIdle()). Meanwhile channelQueue() takes linkLock and
+// sends the packets itself, so they don't wait for the next file data. The
+// most urgent channel with
+// packets queued always goes next, except that after CHANNEL_BURST packets in
+// a row while a less urgent channel waits, that channel gets one packet, so a
+// flood of messages can't stall a transfer.
+//
+// Queued packets are copied into buffers big enough for any packet, which go
+// back to a free list once sent. channelsStart() allocates as many as the
+// queues can hold, so queuing and sending allocate nothing.
+
+#include "channel.h"
+#include "link_layer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Packets sent in a row from more urgent channels while a less urgent one waits
+#define CHANNEL_BURST 8
+
+// Packets queued on a channel before channelQueue() waits
+#define CHANNEL_QUEUE_SIZE 64
+
+typedef struct ChannelPacket {
+    struct ChannelPacket *next;     // Or in spare while not in use
+    int size;
+    unsigned char data[];
+} ChannelPacket;
+
+typedef struct {
+    ChannelPacket *head;
+    ChannelPacket *tail;
+    int queued;
+} Channel;
+
+static Channel channels[MAX_CHANNELS];
+static int nChannels = 0;
+static ChannelWriter writer = NULL;
+static int running = FALSE;
+static int burst = 0;
+static ChannelPacket *spare = NULL;     // Buffers not in use, see newPacket()
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+
+// Held by whichever thread is writing to the link. Taken before lock.
+static pthread_mutex_t linkLock = PTHREAD_MUTEX_INITIALIZER;
+
+int channelsStart(int n, ChannelWriter write) {
+
+    if (n < 1 || n > MAX_CHANNELS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock);
+    memset(channels, 0, sizeof(channels));
+    nChannels = n;
+    writer = write;
+    burst = 0;
+    running = TRUE;
+
+    // What every queue holds, the packet channelSend() adds without waiting
+    // for room and the one being sent
+    for (int i = 0; i < n * CHANNEL_QUEUE_SIZE + 2; i++) {
+        ChannelPacket *p = malloc(sizeof(ChannelPacket) + MAX_PAYLOAD_SIZE);
+
+        if (!p) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        p->next = spare;
+        spare = p;
+    }
+    pthread_mutex_unlock(&lock);
+
+    pthread_mutex_lock(&linkLock);
+    return 0;
+}
+
+// Copy packet into a buffer given back by releasePacket(), or a new one if
+// there is none. Called with lock held.
+// Return NULL on error.
+static ChannelPacket *newPacket(const unsigned char *packet, int size) {
+    ChannelPacket *p = spare;
+
+    if (size > MAX_PAYLOAD_SIZE) {
+        return NULL;
+    }
+
+    if (p) {
+        spare = p->next;
+    } else if (!(p = malloc(sizeof(ChannelPacket) + MAX_PAYLOAD_SIZE))) {
+        return NULL;
+    }
+
+    p->next = NULL;
+    p->size = size;
+    memcpy(p->data, packet, size);
+    return p;
+}
+
+// Give p back once sent.
+static void releasePacket(ChannelPacket *p) {
+    pthread_mutex_lock(&lock);
+    p->next = spare;
+    spare = p;
+    pthread_mutex_unlock(&lock);
+}
+
+// Add p to the end of channel's queue. Called with lock held.
+static void append(int channel, ChannelPacket *p) {
+    Channel *c = &channels[channel];
+
+    if (c->tail) {
+        c->tail->next = p;
+    } else {
+        c->head = p;
+    }
+    c->tail = p;
+    c->queued++;
+}
+
+// Take the next packet to send out of its queue, or return NULL if none is
+// queued. Called with lock held.
+static ChannelPacket *nextPacket() {
+    int urgent = -1;
+    int waiting = -1;   // Least urgent channel with packets queued, besides urgent
+
+    for (int i = nChannels - 1; i >= 0; i--) {
+        if (!channels[i].head) {
+            continue;
+        }
+
+        if (urgent < 0) {
+            urgent = i;
+        } else {
+            waiting = i;
+        }
+    }
+
+    if (urgent < 0) {
+        return NULL;
+    }
+
+    int next = urgent;
+
+    if (waiting < 0) {
+        burst = 0;
+    } else if (burst >= CHANNEL_BURST) {
+        next = waiting;
+        burst = 0;
+    } else {
+        burst++;
+    }
+
+    Channel *c = &channels[next];
+    ChannelPacket *p = c->head;
+
+    c->head = p->next;
+    if (!c->head) {
+        c->tail = NULL;
+    }
+    c->queued--;
+
+    pthread_cond_broadcast(&changed);
+    return p;
+}
+
+int channelFlush() {
+
+    while (TRUE) {
+        pthread_mutex_lock(&lock);
+        ChannelPacket *p = nextPacket();
+        pthread_mutex_unlock(&lock);
+
+        if (!p) {
+            return 0;
+        }
+
+        int result = writer(p->data, p->size);
+        releasePacket(p);
+
+        if (result < 0) {
+            return -1;
+        }
+    }
+}
+
+int channelQueue(int channel, const unsigned char *packet, int size) {
+    pthread_mutex_lock(&lock);
+
+    // Only takes a buffer once there is room, so the queues never hold more
+    // than channelsStart() allocated
+    while (running && channels[channel].queued >= CHANNEL_QUEUE_SIZE) {
+        pthread_cond_wait(&changed, &lock);
+    }
+
+    ChannelPacket *p = running ? newPacket(packet, size) : NULL;
+
+    if (!p) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    append(channel, p);
+    pthread_mutex_unlock(&lock);
+
+    // The link is idle: send it now. Errors show up in the writing thread's
+    // next send.
+    if (pthread_mutex_trylock(&linkLock) == 0) {
+        pthread_mutex_lock(&lock);
+        int stopped = !running;
+        pthread_mutex_unlock(&lock);
+
+        // Otherwise channelsStop() sent it
+        if (!stopped) {
+            channelFlush();
+        }
+        pthread_mutex_unlock(&linkLock);
+    }
+
+    return 0;
+}
+
+int channelSend(int channel, const unsigned char *packet, int size) {
+
+    // Never waits for room: only this thread empties the queues
+    pthread_mutex_lock(&lock);
+    ChannelPacket *own = newPacket(packet, size);
+
+    if (!own) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    append(channel, own);
+    pthread_mutex_unlock(&lock);
+
+    while (TRUE) {
+        pthread_mutex_lock(&lock);
+        ChannelPacket *p = nextPacket();
+        pthread_mutex_unlock(&lock);
+
+        int result = writer(p->data, p->size);
+        int sent = p == own;
+
+        releasePacket(p);
+
+        if (result < 0 || sent) {
+            return result;
+        }
+    }
+}
+
+void channelIdle() {
+    pthread_mutex_unlock(&linkLock);
+}
+
+void channelBusy() {
+    pthread_mutex_lock(&linkLock);
+}
+
+void channelsStop() {
+    int dropped = 0;
+
+    pthread_mutex_lock(&lock);
+    running = FALSE;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    channelFlush();
+
+    // Left if the link failed
+    pthread_mutex_lock(&lock);
+
+    for (int i = 0; i < nChannels; i++) {
+        while (channels[i].head) {
+            ChannelPacket *next = channels[i].head->next;
+            free(channels[i].head);
+            channels[i].head = next;
+            dropped++;
+        }
+        channels[i].tail = NULL;
+        channels[i].queued = 0;
+    }
+
+    while (spare) {
+        ChannelPacket *next = spare->next;
+        free(spare);
+        spare = next;
+    }
+
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&linkLock);
+
+    if (dropped > 0) {
+        printf("%d queued packets were not sent\n", dropped);
+    }
+}
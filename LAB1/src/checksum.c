@@ -0,0 +1,103 @@
+// File checksum implementation
+//
+// CRC-32C is computed with the SSE4.2 crc32 instruction when the CPU has it,
+// and otherwise eight bytes at a time with the slice-by-8 tables.
+
+#include "checksum.h"
+#include <pthread.h>
+#include <string.h>
+
+// Reflected CRC-32C polynomial
+#define CRC32C_POLY 0x82F63B78
+
+// crcTable[k][i] is the CRC of byte i followed by k zero bytes.
+static unsigned int crcTable[8][256];
+
+// Update a non-inverted CRC register over size bytes of data.
+typedef unsigned int (*CrcUpdate)(unsigned int crc, const unsigned char *data, size_t size);
+
+static CrcUpdate crcUpdate = NULL;
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static unsigned int getWord(const unsigned char *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+}
+
+static unsigned int crcSlice8(unsigned int crc, const unsigned char *data, size_t size) {
+
+    while (size >= 8) {
+        unsigned int low = crc ^ getWord(data);
+        unsigned int high = getWord(data + 4);
+
+        crc = crcTable[7][low & 0xFF] ^ crcTable[6][(low >> 8) & 0xFF] ^
+              crcTable[5][(low >> 16) & 0xFF] ^ crcTable[4][low >> 24] ^
+              crcTable[3][high & 0xFF] ^ crcTable[2][(high >> 8) & 0xFF] ^
+              crcTable[1][(high >> 16) & 0xFF] ^ crcTable[0][high >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *data++) & 0xFF];
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static unsigned int crcHardware(unsigned int crc, const unsigned char *data, size_t size) {
+    unsigned long long crc64 = crc;
+
+    while (size >= 8) {
+        unsigned long long word;
+
+        memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+
+        data += 8;
+        size -= 8;
+    }
+
+    crc = crc64;
+
+    while (size-- > 0) {
+        crc = __builtin_ia32_crc32qi(crc, *data++);
+    }
+
+    return crc;
+}
+#endif
+
+static void chooseImplementation() {
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        }
+
+        crcTable[0][i] = crc;
+    }
+
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            crcTable[k][i] = (crcTable[k - 1][i] >> 8) ^ crcTable[0][crcTable[k - 1][i] & 0xFF];
+        }
+    }
+
+    crcUpdate = crcSlice8;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crcUpdate = crcHardware;
+    }
+#endif
+}
+
+unsigned int crc32c(unsigned int crc, const unsigned char *data, size_t size) {
+    pthread_once(&crcOnce, chooseImplementation);
+
+    return ~crcUpdate(~crc, data, size);
+}
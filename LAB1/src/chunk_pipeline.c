@@ -0,0 +1,211 @@
+// Transmitter chunk pipeline implementation
+//
+// Worker threads take turns reading the next chunk of the file (so chunks are
+// numbered in file order), then compress it outside the lock into a slot of a
+// ring. The link thread drains the ring strictly in order, so a slow chunk only
+// delays the chunks after it while the workers keep filling the ring.
+
+#include "chunk_pipeline.h"
+#include "checksum.h"
+#include "compression.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ring slots per worker, so workers stay ahead of the link thread.
+#define SLOTS_PER_WORKER 4
+
+typedef enum {
+    SLOT_EMPTY,
+    SLOT_BUSY,
+    SLOT_READY
+} SlotState;
+
+typedef struct {
+    SlotState state;
+    Chunk chunk;
+} Slot;
+
+static FILE *pipelineFile = NULL;
+static int pipelineCompress = FALSE;
+
+static pthread_t *workers = NULL;
+static int nWorkers = 0;
+
+static Slot *slots = NULL;
+static int nSlots = 0;
+
+static int nextReadSeq = 0;  // Next chunk to be read from the file
+static int nextSendSeq = 0;  // Next chunk to be handed to the link thread
+static int endSeq = -1;      // Number of chunks in the file, once known
+static unsigned int checksum = CRC32C_INIT; // Of the raw bytes read so far, in file order
+static int readError = FALSE;
+static int stopping = FALSE;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+
+// Fill chunk data from the raw file bytes, compressed only if that saves space.
+static void prepareChunk(Chunk *chunk, const unsigned char *raw) {
+    chunk->compressed = FALSE;
+
+    if (pipelineCompress) {
+        int size = compressChunk(raw, chunk->rawSize, chunk->data, chunk->rawSize - 1);
+
+        if (size > 0) {
+            chunk->size = size;
+            chunk->compressed = TRUE;
+            return;
+        }
+    }
+
+    memcpy(chunk->data, raw, chunk->rawSize);
+    chunk->size = chunk->rawSize;
+}
+
+static void *worker(void *arg) {
+    (void)arg;
+
+    unsigned char raw[CHUNK_SIZE];
+
+    pthread_mutex_lock(&lock);
+
+    while (!stopping && endSeq < 0) {
+        Slot *slot = &slots[nextReadSeq % nSlots];
+
+        if (slot->state != SLOT_EMPTY) {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+
+        int rawSize = fread(raw, 1, CHUNK_SIZE, pipelineFile);
+
+        if (rawSize <= 0) {
+            readError = ferror(pipelineFile);
+            endSeq = nextReadSeq;
+            pthread_cond_broadcast(&changed);
+            break;
+        }
+
+        checksum = crc32c(checksum, raw, rawSize);
+
+        slot->state = SLOT_BUSY;
+        slot->chunk.seq = nextReadSeq++;
+        slot->chunk.rawSize = rawSize;
+
+        pthread_mutex_unlock(&lock);
+        prepareChunk(&slot->chunk, raw);
+        pthread_mutex_lock(&lock);
+
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&changed);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int pipelineStart(FILE *file, int compress, int nThreads, unsigned int crc) {
+
+    pipelineFile = file;
+    pipelineCompress = compress;
+    nextReadSeq = 0;
+    nextSendSeq = 0;
+    endSeq = -1;
+    checksum = crc;
+    readError = FALSE;
+    stopping = FALSE;
+
+    // Without compression there is nothing to overlap, chunks are read inline
+    nWorkers = compress ? nThreads : 0;
+
+    if (nWorkers == 0) {
+        return 0;
+    }
+
+    nSlots = nWorkers * SLOTS_PER_WORKER;
+    slots = calloc(nSlots, sizeof(Slot));
+    workers = calloc(nWorkers, sizeof(pthread_t));
+
+    if (!slots || !workers) {
+        printf("Failed to allocate the chunk pipeline\n");
+        pipelineStop();
+        return -1;
+    }
+
+    for (int i = 0; i < nWorkers; i++) {
+        if (pthread_create(&workers[i], NULL, worker, NULL) != 0) {
+            printf("Failed to start compression worker %d\n", i);
+            nWorkers = i;
+            pipelineStop();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int pipelineNext(Chunk *chunk) {
+
+    if (nWorkers == 0) {
+        unsigned char raw[CHUNK_SIZE];
+        int rawSize = fread(raw, 1, CHUNK_SIZE, pipelineFile);
+
+        if (rawSize <= 0) {
+            return ferror(pipelineFile) ? -1 : 0;
+        }
+
+        checksum = crc32c(checksum, raw, rawSize);
+
+        chunk->seq = nextSendSeq++;
+        chunk->rawSize = rawSize;
+        prepareChunk(chunk, raw);
+        return 1;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    Slot *slot = &slots[nextSendSeq % nSlots];
+
+    while (slot->state != SLOT_READY && !(endSeq >= 0 && nextSendSeq >= endSeq)) {
+        pthread_cond_wait(&changed, &lock);
+    }
+
+    if (slot->state != SLOT_READY) {
+        int result = readError ? -1 : 0;
+        pthread_mutex_unlock(&lock);
+        return result;
+    }
+
+    *chunk = slot->chunk;
+    slot->state = SLOT_EMPTY;
+    nextSendSeq++;
+
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    return 1;
+}
+
+unsigned int pipelineChecksum() {
+    return checksum;
+}
+
+void pipelineStop() {
+
+    pthread_mutex_lock(&lock);
+    stopping = TRUE;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < nWorkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    free(slots);
+    workers = NULL;
+    slots = NULL;
+    nWorkers = 0;
+    nSlots = 0;
+}
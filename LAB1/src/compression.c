@@ -0,0 +1,175 @@
+// Chunk compression implementation
+//
+// Each sequence is a token byte (high nibble: literal count, low nibble: match
+// length - MIN_MATCH), an optional literal count extension, the literals, a
+// 2-byte little-endian match offset and an optional match length extension.
+// Counts of 15 or more continue in extension bytes of up to 255 each. The last
+// sequence only carries literals.
+
+#include "compression.h"
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xFFFF
+#define HASH_BITS 12
+
+static unsigned int hash4(const unsigned char *p) {
+    unsigned int v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Write the extension bytes of a count that didn't fit in its token nibble.
+static int writeLength(unsigned char *out, int op, int outCapacity, int length) {
+    while (length >= 255) {
+        if (op >= outCapacity) {
+            return -1;
+        }
+        out[op++] = 255;
+        length -= 255;
+    }
+
+    if (op >= outCapacity) {
+        return -1;
+    }
+    out[op++] = length;
+
+    return op;
+}
+
+// Read the extension bytes of a count whose token nibble is 15.
+static int readLength(const unsigned char *in, int *ip, int inSize, int *length) {
+    unsigned char b;
+
+    do {
+        if (*ip >= inSize) {
+            return -1;
+        }
+        b = in[(*ip)++];
+        *length += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+// Emit one sequence; a matchLength of 0 emits the final literal-only sequence.
+static int writeSequence(unsigned char *out, int op, int outCapacity,
+                         const unsigned char *literals, int literalCount,
+                         int offset, int matchLength) {
+    if (op >= outCapacity) {
+        return -1;
+    }
+
+    int matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+    out[op++] = ((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15);
+
+    if (literalCount >= 15 && (op = writeLength(out, op, outCapacity, literalCount - 15)) < 0) {
+        return -1;
+    }
+
+    if (op + literalCount > outCapacity) {
+        return -1;
+    }
+    memcpy(out + op, literals, literalCount);
+    op += literalCount;
+
+    if (matchLength == 0) {
+        return op;
+    }
+
+    if (op + 2 > outCapacity) {
+        return -1;
+    }
+    out[op++] = offset & 0xFF;
+    out[op++] = (offset >> 8) & 0xFF;
+
+    if (matchCode >= 15 && (op = writeLength(out, op, outCapacity, matchCode - 15)) < 0) {
+        return -1;
+    }
+
+    return op;
+}
+
+int compressChunk(const unsigned char *in, int inSize, unsigned char *out, int outCapacity) {
+
+    int table[1 << HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    int ip = 0;
+    int anchor = 0;
+    int op = 0;
+
+    while (ip + MIN_MATCH <= inSize) {
+        unsigned int h = hash4(in + ip);
+        int ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > MAX_OFFSET || memcmp(in + ref, in + ip, MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+
+        int matchLength = MIN_MATCH;
+        while (ip + matchLength < inSize && in[ref + matchLength] == in[ip + matchLength]) {
+            matchLength++;
+        }
+
+        op = writeSequence(out, op, outCapacity, in + anchor, ip - anchor, ip - ref, matchLength);
+        if (op < 0) {
+            return -1;
+        }
+
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    return writeSequence(out, op, outCapacity, in + anchor, inSize - anchor, 0, 0);
+}
+
+int decompressChunk(const unsigned char *in, int inSize, unsigned char *out, int outCapacity) {
+
+    int ip = 0;
+    int op = 0;
+
+    while (ip < inSize) {
+        unsigned char token = in[ip++];
+
+        int literalCount = token >> 4;
+        if (literalCount == 15 && readLength(in, &ip, inSize, &literalCount) < 0) {
+            return -1;
+        }
+
+        if (ip + literalCount > inSize || op + literalCount > outCapacity) {
+            return -1;
+        }
+        memcpy(out + op, in + ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        if (ip == inSize) {
+            break;
+        }
+
+        if (ip + 2 > inSize) {
+            return -1;
+        }
+        int offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+
+        int matchLength = token & 0x0F;
+        if (matchLength == 15 && readLength(in, &ip, inSize, &matchLength) < 0) {
+            return -1;
+        }
+        matchLength += MIN_MATCH;
+
+        if (offset == 0 || offset > op || op + matchLength > outCapacity) {
+            return -1;
+        }
+
+        // Byte by byte, as the match may overlap the bytes it produces
+        for (int i = 0; i < matchLength; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+
+    return op;
+}
@@ -0,0 +1,190 @@
+// Delta transfer implementation
+//
+// The receiver signs each full block of the file it already has. The sender
+// slides a rolling checksum over its file one byte at a time, confirms hits
+// with the strong hash and replaces every matching block by a copy instruction.
+
+#include "delta.h"
+#include "link_layer.h"
+#include <stdlib.h>
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+unsigned int weakChecksum(const unsigned char *data, int size) {
+    unsigned int a = 0;
+    unsigned int b = 0;
+
+    for (int i = 0; i < size; i++) {
+        a += data[i];
+        b += (size - i) * data[i];
+    }
+
+    return (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+}
+
+unsigned int rollChecksum(unsigned int sum, unsigned char out, unsigned char in, int size) {
+    unsigned int a = sum & 0xFFFF;
+    unsigned int b = sum >> 16;
+
+    a = (a - out + in) & 0xFFFF;
+    b = (b - size * out + a) & 0xFFFF;
+
+    return a | (b << 16);
+}
+
+unsigned long long strongChecksum(const unsigned char *data, int size) {
+    unsigned long long hash = FNV_OFFSET;
+
+    for (int i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+typedef struct {
+    DeltaEmitter *emitter;
+    int maxLiteral;
+    unsigned int copyFirst;  // Pending run of consecutive block copies
+    unsigned int copyCount;
+} ScanState;
+
+static int flushCopy(ScanState *scan) {
+    if (scan->copyCount == 0) {
+        return 0;
+    }
+
+    int result = scan->emitter->copy(scan->emitter->ctx, scan->copyFirst, scan->copyCount);
+    scan->copyCount = 0;
+    return result;
+}
+
+static int flushLiterals(ScanState *scan, const unsigned char *data, size_t size) {
+    if (size > 0 && flushCopy(scan) < 0) {
+        return -1;
+    }
+
+    while (size > 0) {
+        int n = size < (size_t)scan->maxLiteral ? (int)size : scan->maxLiteral;
+
+        if (scan->emitter->literal(scan->emitter->ctx, data, n) < 0) {
+            return -1;
+        }
+
+        data += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int addCopy(ScanState *scan, unsigned int block) {
+    if (scan->copyCount > 0 && scan->copyFirst + scan->copyCount == block) {
+        scan->copyCount++;
+        return 0;
+    }
+
+    if (flushCopy(scan) < 0) {
+        return -1;
+    }
+
+    scan->copyFirst = block;
+    scan->copyCount = 1;
+    return 0;
+}
+
+int deltaScan(const unsigned char *data, size_t size, const BlockSignature *sigs, int nSigs,
+              int blockSize, int maxLiteral, DeltaEmitter *emitter) {
+
+    ScanState scan = {emitter, maxLiteral, 0, 0};
+
+    // Chained hash table from rolling checksum to signature index
+    int nBuckets = 1;
+    while (nBuckets < nSigs * 2) {
+        nBuckets <<= 1;
+    }
+
+    int *buckets = malloc(nBuckets * sizeof(int));
+    int *next = malloc((nSigs > 0 ? nSigs : 1) * sizeof(int));
+
+    if (!buckets || !next) {
+        free(buckets);
+        free(next);
+        return -1;
+    }
+
+    for (int i = 0; i < nBuckets; i++) {
+        buckets[i] = -1;
+    }
+
+    // Inserted backwards so chains list the lowest block first
+    for (int i = nSigs - 1; i >= 0; i--) {
+        int bucket = sigs[i].weak & (nBuckets - 1);
+        next[i] = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    size_t pos = 0;
+    size_t literalStart = 0;
+    int result = 0;
+    unsigned int weak = 0;
+
+    if (nSigs > 0 && size >= (size_t)blockSize) {
+        weak = weakChecksum(data, blockSize);
+    }
+
+    while (nSigs > 0 && pos + blockSize <= size) {
+        int match = -1;
+        int haveStrong = FALSE;
+        unsigned long long strong = 0;
+
+        for (int i = buckets[weak & (nBuckets - 1)]; i >= 0; i = next[i]) {
+            if (sigs[i].weak != weak) {
+                continue;
+            }
+
+            if (!haveStrong) {
+                strong = strongChecksum(data + pos, blockSize);
+                haveStrong = TRUE;
+            }
+
+            if (sigs[i].strong == strong) {
+                match = i;
+                break;
+            }
+        }
+
+        if (match >= 0) {
+            if (flushLiterals(&scan, data + literalStart, pos - literalStart) < 0 || addCopy(&scan, match) < 0) {
+                result = -1;
+                break;
+            }
+
+            pos += blockSize;
+            literalStart = pos;
+
+            if (pos + blockSize <= size) {
+                weak = weakChecksum(data + pos, blockSize);
+            }
+        } else if (pos + blockSize < size) {
+            weak = rollChecksum(weak, data[pos], data[pos + blockSize], blockSize);
+            pos++;
+        } else {
+            break;
+        }
+    }
+
+    if (result == 0) {
+        result = flushLiterals(&scan, data + literalStart, size - literalStart);
+    }
+
+    if (result == 0) {
+        result = flushCopy(&scan);
+    }
+
+    free(buckets);
+    free(next);
+    return result;
+}
@@ -0,0 +1,94 @@
+// Receiver checkpoint journal implementation
+//
+// The journal lives next to the received file as "<filename>.journal" and
+// holds a single fixed-width record "<file size> <committed offset>", which is
+// rewritten in place after the file data up to that offset reaches the disk.
+
+#include "journal.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_SIZE 42
+
+static int journalFd = -1;
+static size_t journalFileSize = 0;
+static char journalName[PATH_MAX];
+
+static void journalPath(char *path, const char *filename) {
+    snprintf(path, PATH_MAX, "%s.journal", filename);
+}
+
+size_t journalLoad(const char *filename, size_t fileSize) {
+    char path[PATH_MAX];
+    char record[RECORD_SIZE + 1] = {0};
+    size_t size = 0;
+    size_t offset = 0;
+
+    journalPath(path, filename);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    int n = read(fd, record, RECORD_SIZE);
+    close(fd);
+
+    if (n <= 0 || sscanf(record, "%zu %zu", &size, &offset) != 2 || size != fileSize || offset > fileSize) {
+        return 0;
+    }
+
+    return offset;
+}
+
+int journalOpen(const char *filename, size_t fileSize) {
+    journalPath(journalName, filename);
+    journalFileSize = fileSize;
+
+    journalFd = open(journalName, O_WRONLY | O_CREAT, 0644);
+    if (journalFd < 0) {
+        perror(journalName);
+        return -1;
+    }
+
+    return 0;
+}
+
+int journalCommit(FILE *file, size_t offset) {
+    char record[RECORD_SIZE + 1];
+
+    if (journalFd < 0) {
+        return -1;
+    }
+
+    // The data must be on disk before the journal claims it is
+    if (fflush(file) != 0 || fdatasync(fileno(file)) < 0) {
+        perror("fdatasync");
+        return -1;
+    }
+
+    snprintf(record, sizeof(record), "%020zu %020zu\n", journalFileSize, offset);
+
+    if (pwrite(journalFd, record, RECORD_SIZE, 0) != RECORD_SIZE) {
+        perror(journalName);
+        return -1;
+    }
+
+    return 0;
+}
+
+void journalClose(int completed) {
+    if (journalFd < 0) {
+        return;
+    }
+
+    close(journalFd);
+    journalFd = -1;
+
+    if (completed) {
+        unlink(journalName);
+    }
+}
@@ -0,0 +1,346 @@
+// Serial port I/O threads implementation
+//
+// Each ring is a power-of-two buffer with free-running head and tail counters:
+// only the producer moves head and only the consumer moves tail, so pushing and
+// popping need no lock, just acquire/release ordering on the counters. A side
+// that finds its ring empty (or full) sleeps on an eventfd the other side
+// signals after moving its counter. The RX ring's data eventfd also lets epoll
+// wait for received bytes, and a third eventfd lets it wait for room in the TX
+// ring (see ioWrite()).
+
+#include "link_io.h"
+#include "link_layer.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Bytes each ring holds
+#define RING_SIZE (1 << 16)
+
+// Bytes moved between a ring and the serial port at once
+#define IO_CHUNK 4096
+
+// Milliseconds a sleeping side waits before looking again (0.1 second, like VTIME)
+#define IO_WAIT 100
+
+// Largest eventfd counter: an eventfd holding it can't be written, so it doesn't
+// poll writable (POLLOUT) until it is read
+#define EVENTFD_FULL 0xfffffffffffffffeULL
+
+typedef struct {
+    unsigned char data[RING_SIZE];
+    atomic_size_t head;     // Bytes ever pushed
+    atomic_size_t tail;     // Bytes ever popped
+    int dataFd;             // Signalled after a push
+    int spaceFd;            // Signalled after a pop from a full ring
+} Ring;
+
+struct LinkIo {
+    int fd;
+    Ring rx;
+    Ring tx;
+    pthread_t rxThread;
+    pthread_t txThread;
+    atomic_int stopping;
+    atomic_int failed;      // The serial port returned an error
+
+    // Writable (POLLOUT) unless ioWrite() found the TX ring full: it is then
+    // set to EVENTFD_FULL, and read again once the TX thread makes room
+    int writableFd;
+    atomic_int txFull;
+};
+
+static void notify(int eventFd) {
+    uint64_t one = 1;
+    (void)!write(eventFd, &one, sizeof(one));
+}
+
+// Wait up to IO_WAIT milliseconds for eventFd to be signalled, and reset it.
+static void waitFor(int eventFd) {
+    struct pollfd p = {.fd = eventFd, .events = POLLIN};
+    uint64_t count;
+
+    if (poll(&p, 1, IO_WAIT) > 0) {
+        (void)!read(eventFd, &count, sizeof(count));
+    }
+}
+
+// Wait up to IO_WAIT for the serial port to be ready for events, whatever its
+// VTIME (0 makes read() return at once). Return TRUE if it is.
+static int waitForPort(int fd, short events) {
+    struct pollfd p = {.fd = fd, .events = events};
+
+    return poll(&p, 1, IO_WAIT) > 0;
+}
+
+static size_t ringUsed(Ring *r) {
+    return atomic_load_explicit(&r->head, memory_order_acquire) - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+// Copy up to n bytes into the ring. Producer only.
+static int push(Ring *r, const unsigned char *bytes, int n) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t room = RING_SIZE - (head - tail);
+
+    if ((size_t)n > room) {
+        n = room;
+    }
+
+    for (int i = 0; i < n; i++) {
+        r->data[(head + i) & (RING_SIZE - 1)] = bytes[i];
+    }
+
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+
+    if (n > 0) {
+        notify(r->dataFd);
+    }
+    return n;
+}
+
+// Copy up to n bytes out of the ring. Consumer only.
+static int pop(Ring *r, unsigned char *bytes, int n) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    int wasFull = head - tail == RING_SIZE;
+
+    if ((size_t)n > head - tail) {
+        n = head - tail;
+    }
+
+    for (int i = 0; i < n; i++) {
+        bytes[i] = r->data[(tail + i) & (RING_SIZE - 1)];
+    }
+
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+
+    // Only a full ring keeps the producer waiting
+    if (n > 0 && wasFull) {
+        notify(r->spaceFd);
+    }
+    return n;
+}
+
+static void *rxThread(void *arg) {
+    LinkIo *io = arg;
+    unsigned char bytes[IO_CHUNK];
+
+    while (!atomic_load(&io->stopping)) {
+        int room = RING_SIZE - ringUsed(&io->rx);
+
+        if (room == 0) {
+            waitFor(io->rx.spaceFd);
+            continue;
+        }
+
+        // Look at stopping again after IO_WAIT without bytes
+        if (!waitForPort(io->fd, POLLIN)) {
+            continue;
+        }
+
+        int n = read(io->fd, bytes, room < IO_CHUNK ? room : IO_CHUNK);
+
+        if (n < 0 && errno != EINTR && errno != EAGAIN) {
+            atomic_store(&io->failed, TRUE);
+            notify(io->rx.dataFd);
+            break;
+        }
+
+        if (n > 0) {
+            push(&io->rx, bytes, n);
+        }
+    }
+
+    return NULL;
+}
+
+// Make writableFd writable again.
+static void clearTxFull(LinkIo *io) {
+    uint64_t count;
+
+    if (atomic_exchange(&io->txFull, FALSE)) {
+        (void)!read(io->writableFd, &count, sizeof(count));
+    }
+}
+
+static void *txThread(void *arg) {
+    LinkIo *io = arg;
+    unsigned char bytes[IO_CHUNK];
+
+    while (TRUE) {
+        int n = pop(&io->tx, bytes, IO_CHUNK);
+
+        if (n > 0) {
+            clearTxFull(io);
+        }
+
+        if (n == 0) {
+            // Only stop once every queued byte is written
+            if (atomic_load(&io->stopping)) {
+                break;
+            }
+            waitFor(io->tx.dataFd);
+            continue;
+        }
+
+        // After an error, keep emptying the ring so ioWrite() never blocks
+        for (int written = 0; written < n && !atomic_load(&io->failed);) {
+            int w = write(io->fd, bytes + written, n - written);
+
+            if (w < 0 && errno == EAGAIN) {
+                waitForPort(io->fd, POLLOUT);
+            } else if (w < 0 && errno != EINTR) {
+                atomic_store(&io->failed, TRUE);
+            } else if (w > 0) {
+                written += w;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int initRing(Ring *r) {
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->dataFd = eventfd(0, EFD_NONBLOCK);
+    r->spaceFd = eventfd(0, EFD_NONBLOCK);
+
+    return r->dataFd >= 0 && r->spaceFd >= 0 ? 0 : -1;
+}
+
+static void freeRing(Ring *r) {
+    if (r->dataFd >= 0) {
+        close(r->dataFd);
+    }
+    if (r->spaceFd >= 0) {
+        close(r->spaceFd);
+    }
+}
+
+static void freeIo(LinkIo *io) {
+    freeRing(&io->rx);
+    freeRing(&io->tx);
+
+    if (io->writableFd >= 0) {
+        close(io->writableFd);
+    }
+    free(io);
+}
+
+LinkIo *ioStart(int fd) {
+    LinkIo *io = malloc(sizeof(LinkIo));
+
+    if (!io) {
+        return NULL;
+    }
+
+    io->fd = fd;
+    atomic_init(&io->stopping, FALSE);
+    atomic_init(&io->failed, FALSE);
+    atomic_init(&io->txFull, FALSE);
+    io->rx.dataFd = io->rx.spaceFd = io->tx.dataFd = io->tx.spaceFd = -1;
+    io->writableFd = eventfd(0, EFD_NONBLOCK);
+
+    if (io->writableFd < 0 || initRing(&io->rx) < 0 || initRing(&io->tx) < 0) {
+        freeIo(io);
+        return NULL;
+    }
+
+    if (pthread_create(&io->rxThread, NULL, rxThread, io) != 0) {
+        freeIo(io);
+        return NULL;
+    }
+
+    if (pthread_create(&io->txThread, NULL, txThread, io) != 0) {
+        atomic_store(&io->stopping, TRUE);
+        pthread_join(io->rxThread, NULL);
+        freeIo(io);
+        return NULL;
+    }
+
+    return io;
+}
+
+int ioRead(LinkIo *io, unsigned char *bytes, int numBytes, int wait) {
+    uint64_t count;
+    int n = pop(&io->rx, bytes, numBytes);
+
+    if (n > 0) {
+        return n;
+    }
+
+    // Reset the eventfd before looking again, so a push right after still
+    // wakes up epoll
+    int signalled = read(io->rx.dataFd, &count, sizeof(count)) == sizeof(count);
+
+    if ((n = pop(&io->rx, bytes, numBytes)) == 0 && wait && !signalled && !atomic_load(&io->failed)) {
+        waitFor(io->rx.dataFd);
+        n = pop(&io->rx, bytes, numBytes);
+    }
+
+    if (n > 0) {
+        // Keep the eventfd readable for what is left
+        if (ringUsed(&io->rx) > 0) {
+            notify(io->rx.dataFd);
+        }
+        return n;
+    }
+
+    return atomic_load(&io->failed) ? -1 : 0;
+}
+
+int ioWrite(LinkIo *io, const unsigned char *bytes, int numBytes) {
+
+    if (atomic_load(&io->failed)) {
+        return -1;
+    }
+
+    int n = push(&io->tx, bytes, numBytes);
+
+    if (n < numBytes) {
+        uint64_t full = EVENTFD_FULL;
+
+        // Set before txFull, so the TX thread reads it back once it sees
+        // txFull; and look again, in case it made room before that
+        (void)!write(io->writableFd, &full, sizeof(full));
+        atomic_store(&io->txFull, TRUE);
+
+        if (ringUsed(&io->tx) < RING_SIZE) {
+            clearTxFull(io);
+        }
+    }
+
+    return n;
+}
+
+int ioWritableFd(LinkIo *io) {
+    return io->writableFd;
+}
+
+int ioEventFd(LinkIo *io) {
+    return io->rx.dataFd;
+}
+
+void ioStop(LinkIo *io) {
+
+    if (!io) {
+        return;
+    }
+
+    atomic_store(&io->stopping, TRUE);
+    notify(io->tx.dataFd);
+
+    pthread_join(io->txThread, NULL);
+    pthread_join(io->rxThread, NULL);
+
+    freeIo(io);
+}
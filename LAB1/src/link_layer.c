@@ -1,12 +1,20 @@
 // Link layer protocol implementation
 
 #include "link_layer.h"
+#include "link_session.h"
+#include "transport.h"
 #include "serial_port.h"
+#include "duplex.h"
+#include "options.h"
 #include <stdio.h>
-#include <signal.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
@@ -19,11 +27,38 @@
 
 #define C_RR(sequenceNum) (0xAA | (sequenceNum))
 #define C_REJ(sequenceNum) (0x54 | (sequenceNum))
-#define C_SEQ(sequenceNum) (sequenceNum << 7)
+#define C_SEQ(sequenceNum) ((sequenceNum) << 7)
+#define C_NR(sequenceNum) ((sequenceNum) << 6)  // Piggybacked acknowledgement (full duplex)
 
 #define C_DISC          0x0B
 #define ESCAPE          0x7D
 
+// Longest wait (in seconds) between SET frames while reconnecting
+#define MAX_RECONNECT_BACKOFF 16
+
+// Longest time (in seconds) an acknowledgement waits for an I-frame to carry it
+// before it is sent in an RR frame of its own (full duplex)
+#define ACK_DELAY 0.02
+
+// Largest I-frame data (packet and BCC2) accepted by the event-loop and
+// full-duplex parsers, leaving room for a header around the application's
+// packet (see bond.c). linkRead() and linkReadDuplex() only take packets of up
+// to MAX_PAYLOAD_SIZE bytes, the size of the caller's buffer.
+#define MAX_FRAME_DATA (MAX_PAYLOAD_SIZE + 64)
+
+// Frame buffers each session allocates when it opens, see takeFrame(). Enough
+// for the frames the application and --bond keep queued, plus one; the pool
+// grows to the most frames a session keeps queued at once.
+#define FRAME_POOL_SIZE 4
+
+// Bytes of a pooled frame buffer: a stuffed I-frame of up to MAX_FRAME_DATA
+// bytes of data (see buildFrame())
+#define POOL_FRAME_SIZE (MAX_FRAME_DATA * 2 + 8)
+
+// Buckets of the ACK turnaround histogram: bucket i counts the turnarounds of
+// 2^i to 2^(i+1) microseconds, the last one also the longer ones
+#define TURNAROUND_BUCKETS 24
+
 typedef enum {
     START,
     FLAG_RCV,
@@ -35,105 +70,489 @@ typedef enum {
     ESCAPE_STATE
 } State;
 
-LinkLayer info;
-State state = START;
+// A frame given to linkSubmit(), already stuffed. Its control byte and BCC1
+// are filled in when it is first sent.
+typedef struct QueuedFrame {
+    struct QueuedFrame *next;
+    LinkWriteDone done;
+    void *context;
+    int size;
+    int sent;           // Bytes of its current transmission written so far
+    int pooled;         // Taken from the session's frame pool, see takeFrame()
+    unsigned char frame[];
+} QueuedFrame;
+
+struct LinkSession {
+    LinkLayer info;
+    Transport *transport;
+
+    // Bytes read but not parsed yet, see linkPoll()
+    unsigned char input[MAX_PAYLOAD_SIZE];
+    int inputStart;
+    int inputEnd;
+
+    State state;
+    unsigned char byte;
+    int sequenceNum;
+
+    // Retransmission timer: runs out at deadline (seconds, see linkTime())
+    int timerSet;
+    double deadline;
+    int timeouts;       // Since the frame being sent was first sent
+
+    unsigned int totalFramesExchanged;
+    unsigned int retries;
+
+    // Receive overruns of the port (see noteOverrun()), or -1 if it can't tell
+    int overrunsAtOpen;
+    int overrunsSeen;
+    unsigned int overrunErrors;     // Rejections and timeouts after an overrun
+
+    unsigned int outages;
+    double outageTime;          // Seconds from the last acknowledged frame to the link answering again
+    double recoveryLatency;     // Seconds from the link answering again to the next acknowledged frame
+    double lastAckTime;
+    double linkBackTime;        // When the link last answered again, until the next acknowledged frame
+
+    double sentTime;            // When the frame in flight was last written
+    unsigned int turnaround[TURNAROUND_BUCKETS];    // From writing an I-frame to reading its RR
+
+    // Full-duplex state, see linkStartDuplex()
+    int duplex;
+    pthread_t reader;
+    pthread_t ackTimer;
+    volatile int stopping;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_mutex_t writeLock;  // Taken before lock
+
+    int startSeq;
+    int sendSeq;        // N(S): sequence number of the next I-frame we send
+    int recvSeq;        // N(R): sequence number of the next I-frame we expect
+    int acked;          // The frame with N(S) sendSeq was acknowledged
+    int rejected;       // The frame with N(S) sendSeq was rejected
+    int writing;        // linkWrite is waiting for its frame to be acknowledged
+    double lastWriteTime;
+
+    int ackPending;     // linkRead took a frame we haven't acknowledged yet
+    struct timespec ackDeadline;
+
+    unsigned char received[MAX_FRAME_DATA];
+    int receivedSize;
+    int receivedReady;  // received holds the frame with N(S) recvSeq, not yet taken
+    int disc;           // The first DISC of linkClose was already read
+    int broken;         // The reader thread's read failed: nothing more will come
+
+    // I-frame data and BCC2 being read by linkRead
+    unsigned char readData[MAX_PAYLOAD_SIZE + 1];
+
+    unsigned int piggybackedAcks;
+    unsigned int standaloneAcks;
+
+    // Frame being read byte by byte (full duplex and event loops)
+    unsigned char frame[MAX_FRAME_DATA + 3];
+    int frameSize;
+    int escaped;
+    int overflow;
+
+    // Event-loop state, see linkSubmit()
+    QueuedFrame *queueHead;     // Sent and waiting for its acknowledgement if inFlight
+    QueuedFrame *queueTail;
+    int queued;
+    int inFlight;
+    int sending;                // The frame in flight is only partly written, see linkProcessOutput()
+    int completed;              // Frames acknowledged or failed, see linkPoll()
+    int reconnect;              // Re-establish the link once a frame runs out of retries
+    int reconnecting;           // Sending SET frames until the link answers, see reconnectStep()
+    double reconnectStart;
+    int backoff;                // Seconds to wait for the UA of the last SET
+    LinkPacketHandler packetHandler;
+    void *handlerContext;
+
+    // Pooled frame buffers not in use, see takeFrame()
+    QueuedFrame *freeFrames;
+};
+
+// Session used by llopen(), llwrite(), llread() and llclose()
+static LinkSession *defaultSession = NULL;
+
+static int linkWriteDuplex(LinkSession *s, const unsigned char *buf, int bufSize);
+static int linkReadDuplex(LinkSession *s, unsigned char *packet);
+static void printTurnaround(LinkSession *s);
+
+double linkTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int readByte(LinkSession *s, unsigned char *byte) {
+    if (s->inputStart < s->inputEnd) {
+        *byte = s->input[s->inputStart++];
+        return 1;
+    }
+    return s->transport->ops->read(s->transport, byte, 1, TRUE);
+}
+
+static int readBytes(LinkSession *s, unsigned char *bytes, int numBytes, int wait) {
+    if (s->inputStart < s->inputEnd) {
+        int n = s->inputEnd - s->inputStart;
+
+        if (n > numBytes) {
+            n = numBytes;
+        }
+        memcpy(bytes, s->input + s->inputStart, n);
+        s->inputStart += n;
+        return n;
+    }
+    return s->transport->ops->read(s->transport, bytes, numBytes, wait);
+}
+
+// Write all numBytes. While the transport is full, wait for room, for up to the
+// timeout since the last bytes went out.
+// Returns -1 on error, otherwise the number of bytes written (short if the
+// transport stayed full).
+static int writeBytes(LinkSession *s, const unsigned char *bytes, int numBytes) {
+    int written = 0;
+    double end = linkTime() + s->info.timeout;
+
+    while (written < numBytes) {
+        int n = s->transport->ops->write(s->transport, bytes + written, numBytes - written);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        if (n > 0) {
+            written += n;
+            end = linkTime() + s->info.timeout;
+            continue;
+        }
+
+        double left = end - linkTime();
+
+        if (left <= 0) {
+            break;
+        }
+
+        // Without a file descriptor, the write itself waited a little
+        struct pollfd p = {.fd = s->transport->ops->writeFd(s->transport), .events = POLLOUT};
+
+        if (p.fd >= 0 && poll(&p, 1, (int) (left * 1000) + 1) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+
+    return written;
+}
+
+// Send what is queued and close the transport.
+static int closePort(LinkSession *s) {
+    int closed = s->transport->ops->close(s->transport);
+    s->transport = NULL;
+    return closed;
+}
+
+static void startTimer(LinkSession *s, int seconds) {
+    s->deadline = linkTime() + seconds;
+    s->timerSet = TRUE;
+}
+
+// A frame was rejected or ran out of time. If the port overran since the last
+// such error, bytes were lost to it rather than to line noise: count the error
+// as caused by an overrun.
+static void noteOverrun(LinkSession *s) {
+    if (s->overrunsSeen < 0) {
+        return;
+    }
+
+    int overruns = s->transport->ops->overruns(s->transport);
+
+    if (overruns > s->overrunsSeen) {
+        s->overrunErrors++;
+        s->overrunsSeen = overruns;
+    }
+}
+
+static void stopTimer(LinkSession *s) {
+    s->timerSet = FALSE;
+}
+
+// Return TRUE while the timer runs. Once it runs out, count the timeout as a
+// retry and return FALSE.
+static int timerRunning(LinkSession *s) {
+    if (s->timerSet && linkTime() >= s->deadline) {
+        s->timerSet = FALSE;
+        s->timeouts++;
+        s->retries++;
+        noteOverrun(s);
+        printf("\nCouldn't receive frame in time - Retrying...\n");
+    }
+    return s->timerSet;
+}
+
+// Return TRUE if byte must be escaped inside a frame: the flag and the escape
+// byte and, with software flow control, the bytes the driver takes as XON and
+// XOFF.
+static int mustEscape(unsigned char byte) {
+    if (byte == FLAG || byte == ESCAPE) {
+        return TRUE;
+    }
+    return options.flow == FLOW_XONXOFF && (byte == XON || byte == XOFF);
+}
+
+// Put byte at frame[n], escaped if needed. Return the size of the frame.
+static int stuffByte(unsigned char *frame, int n, unsigned char byte) {
+    if (mustEscape(byte)) {
+        frame[n++] = ESCAPE;
+        frame[n++] = byte ^ 0x20;
+    } else {
+        frame[n++] = byte;
+    }
+    return n;
+}
+
+// Build the I-frame with the given control byte carrying buf in frame, which
+// must hold bufSize * 2 + 8 bytes. Return the frame's size.
+static int buildFrame(unsigned char *frame, unsigned char control, const unsigned char *buf, int bufSize) {
+
+    unsigned char bcc2 = 0;
+
+    frame[0] = FLAG;
+    frame[1] = A_TRANS;
+    frame[2] = control;
+    frame[3] = A_TRANS ^ control;
+
+    int n = 4;
+
+    for (int i = 0; i < bufSize; i++) {
+        n = stuffByte(frame, n, buf[i]);
+        bcc2 ^= buf[i];
+    }
+
+    n = stuffByte(frame, n, bcc2);
+
+    frame[n] = FLAG;
+    n++;
+
+    return n;
+}
+
+// Add c to the frame being read. Once its closing flag arrives, pass the frame
+// (address, control, BCC1 and data, after destuffing) to handler.
+static void parseByte(LinkSession *s, unsigned char c, void (*handler)(LinkSession *, const unsigned char *, int)) {
+
+    if (c == FLAG) {
+        if (s->frameSize > 0 && !s->overflow) {
+            handler(s, s->frame, s->frameSize);
+        }
+        s->frameSize = 0;
+        s->escaped = FALSE;
+        s->overflow = FALSE;
+    } else if (c == ESCAPE) {
+        s->escaped = TRUE;
+    } else if (s->frameSize == sizeof(s->frame)) {
+        s->overflow = TRUE;
+    } else {
+        s->frame[s->frameSize++] = s->escaped ? c ^ 0x20 : c;
+        s->escaped = FALSE;
+    }
+}
+
+// Allocate a pooled frame buffer, which releaseFrame() keeps for the next
+// frame. Return NULL on error.
+static QueuedFrame *newPooledFrame() {
+    QueuedFrame *f = malloc(sizeof(QueuedFrame) + POOL_FRAME_SIZE);
+
+    if (f) {
+        f->pooled = TRUE;
+    }
+    return f;
+}
+
+// Allocate the session's frame pool. Returns -1 on error.
+static int createFramePool(LinkSession *s) {
+
+    for (int i = 0; i < FRAME_POOL_SIZE; i++) {
+        QueuedFrame *f = newPooledFrame();
+
+        if (!f) {
+            return -1;
+        }
+
+        f->next = s->freeFrames;
+        s->freeFrames = f;
+    }
+    return 0;
+}
+
+// Take a frame buffer for bufSize bytes of data from the pool, so sending
+// (and sending again) doesn't allocate anything. When more frames are queued
+// than ever before the pool gets one more buffer, so it ends up as deep as the
+// caller's queue. Only frames too big for a pooled buffer are allocated (and
+// freed by releaseFrame()) each time.
+// Return NULL on error.
+static QueuedFrame *takeFrame(LinkSession *s, int bufSize) {
+    QueuedFrame *f;
+
+    if (bufSize * 2 + 8 > POOL_FRAME_SIZE) {
+        f = malloc(sizeof(QueuedFrame) + bufSize * 2 + 8);
+
+        if (!f) {
+            return NULL;
+        }
+        f->pooled = FALSE;
+    } else if (s->freeFrames) {
+        f = s->freeFrames;
+        s->freeFrames = f->next;
+    } else if (!(f = newPooledFrame())) {
+        return NULL;
+    }
 
-int sequenceNum = 0;
+    f->next = NULL;
+    return f;
+}
 
-volatile int alarmSet = FALSE;
-int alarmCount = 0;
+static void releaseFrame(LinkSession *s, QueuedFrame *f) {
+    if (f->pooled) {
+        f->next = s->freeFrames;
+        s->freeFrames = f;
+    } else {
+        free(f);
+    }
+}
 
-unsigned int totalFramesExchanged = 0;
-unsigned int retries = 0;
+static void freeSession(LinkSession *s) {
+    while (s->queueHead) {
+        QueuedFrame *next = s->queueHead->next;
+        releaseFrame(s, s->queueHead);
+        s->queueHead = next;
+    }
 
-unsigned char byte;
+    while (s->freeFrames) {
+        QueuedFrame *next = s->freeFrames->next;
+        free(s->freeFrames);
+        s->freeFrames = next;
+    }
 
-void alarmHandler(int signal) {
-    alarmSet = FALSE;
-    alarmCount++;
-    retries++;
-    printf("\nCouldn't receive frame in time - Retrying...\n");
+    pthread_mutex_destroy(&s->lock);
+    pthread_mutex_destroy(&s->writeLock);
+    pthread_cond_destroy(&s->changed);
+    free(s);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int llopen(LinkLayer connectionParameters) {
+LinkSession *linkOpen(LinkLayer connectionParameters) {
 
-    info = connectionParameters;
+    LinkSession *s = calloc(1, sizeof(LinkSession));
 
-    if (openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate) < 0) {
-        return -1;
+    if (!s) {
+        return NULL;
     }
 
+    s->info = connectionParameters;
+    s->state = START;
+    s->reconnect = options.reconnect;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->writeLock, NULL);
+
+    if (createFramePool(s) < 0) {
+        freeSession(s);
+        return NULL;
+    }
+
+    s->transport = transportOpen(connectionParameters);
+
+    if (!s->transport) {
+        freeSession(s);
+        return NULL;
+    }
+
+    s->overrunsAtOpen = s->overrunsSeen = s->transport->ops->overruns(s->transport);
+
     int bytesWritten = 0;
 
     if (connectionParameters.role == LlTx) {
-        (void)signal(SIGALRM, alarmHandler);
 
         unsigned char frame_test[5] = {FLAG, A_TRANS, C_SET, A_TRANS ^ C_SET, FLAG};
 
-        alarmCount = 0;
-        
-        while (alarmCount < connectionParameters.nRetransmissions) {
-            
-            bytesWritten = writeBytesSerialPort(frame_test, 5);
-            totalFramesExchanged++;
+        s->timeouts = 0;
+
+        while (s->timeouts < connectionParameters.nRetransmissions) {
+
+            bytesWritten = writeBytes(s, frame_test, 5);
+            s->totalFramesExchanged++;
 
             if (bytesWritten == 5) {
-                alarm(connectionParameters.timeout);
-                alarmSet = TRUE;
+                startTimer(s, connectionParameters.timeout);
             } else {
                 printf("Error while writting test frame\n");
-                closeSerialPort();
-                return -1;
+                closePort(s);
+                freeSession(s);
+                return NULL;
             }
 
-            state = START;
+            s->state = START;
+
+            while (timerRunning(s) && s->state != STOP_STATE) {
 
-            while (alarmSet && state != STOP_STATE) {
+                int byteRead = readByte(s, &s->byte);
 
-                int byteRead = readByteSerialPort(&byte);
+                if (byteRead < 0) {
+                    printf("Error while reading the port\n");
+                    closePort(s);
+                    freeSession(s);
+                    return NULL;
+                }
 
                 if (byteRead == 1) {
-                    switch (state) {
+                    switch (s->state) {
                         case START:
-                            if (byte == FLAG) {
-                                state = FLAG_RCV;
+                            if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         case FLAG_RCV:
-                            if (byte == A_TRANS) {
-                                state = A_RCV;
-                            } else if (byte != FLAG){
-                                state = START;
+                            if (s->byte == A_TRANS) {
+                                s->state = A_RCV;
+                            } else if (s->byte != FLAG){
+                                s->state = START;
                             }
                             break;
                         case A_RCV:
-                            if (byte == C_UA) {
-                                state = C_RCV;
-                            } else if (byte == FLAG) {
-                                state = FLAG_RCV;
+                            if (s->byte == C_UA) {
+                                s->state = C_RCV;
+                            } else if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         case C_RCV:
-                            if (byte == (A_TRANS ^ C_UA)) {
-                                state = BCC_OK;
-                            } else if (byte == FLAG) {
-                                state = FLAG_RCV;
+                            if (s->byte == (A_TRANS ^ C_UA)) {
+                                s->state = BCC_OK;
+                            } else if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         case BCC_OK:
-                            if (byte == FLAG) {
-                                state = STOP_STATE;
+                            if (s->byte == FLAG) {
+                                s->state = STOP_STATE;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         default:
@@ -142,63 +561,71 @@ int llopen(LinkLayer connectionParameters) {
                 }
             }
 
-            if (state == STOP_STATE) {
-                alarm(0);
-                alarmSet = FALSE;
+            if (s->state == STOP_STATE) {
+                stopTimer(s);
+                s->lastAckTime = linkTime();
                 printf("Connection successfully tested and working!\n\n");
-                return 1;
+                return s;
             }
         }
 
         printf("Opening connection failed - Too many attempts\n");
-        closeSerialPort();
-        return -1;
+        closePort(s);
+        freeSession(s);
+        return NULL;
 
     } else if (connectionParameters.role == LlRx) {
 
-        while (state != STOP_STATE) {
+        while (s->state != STOP_STATE) {
 
-            int byteRead = readByteSerialPort(&byte);
+            int byteRead = readByte(s, &s->byte);
+
+            if (byteRead < 0) {
+                printf("Error while reading the port\n");
+                closePort(s);
+                freeSession(s);
+                return NULL;
+            }
 
             if (byteRead == 1) {
-                switch (state) {
+                switch (s->state) {
                     case START:
-                        if (byte == FLAG) {
-                            state = FLAG_RCV;
+                        if (s->byte == FLAG) {
+                            s->state = FLAG_RCV;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     case FLAG_RCV:
-                        if (byte == A_TRANS) {
-                            state = A_RCV;
-                        } else if (byte != FLAG) {
-                            state = START;
+                        if (s->byte == A_TRANS) {
+                            s->state = A_RCV;
+                        } else if (s->byte != FLAG) {
+                            s->state = START;
                         }
                         break;
                     case A_RCV:
-                        if (byte == C_SET) {
-                            state = C_RCV;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
+                        if (s->byte == C_SET) {
+                            s->state = C_RCV;
+                        } else if (s->byte == FLAG) {
+                            s->state = FLAG_RCV;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     case C_RCV:
-                        if (byte == (A_TRANS ^ C_SET)) {
-                            state = BCC_OK;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
+                        if (s->byte == (A_TRANS ^ C_SET)) {
+                            s->state = BCC_OK;
+                        } else if (s->byte == FLAG) {
+                            s->state = FLAG_RCV;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     case BCC_OK:
-                        if (byte == FLAG) {
-                            state = STOP_STATE;
+                        if (s->byte == FLAG) {
+                            s->state = STOP_STATE;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     default:
@@ -206,269 +633,213 @@ int llopen(LinkLayer connectionParameters) {
                 }
             }
 
-            if (state == STOP_STATE) {
+            if (s->state == STOP_STATE) {
                 unsigned char answer_test[5] = {FLAG, A_TRANS, C_UA, A_TRANS ^ C_UA, FLAG};
 
-                bytesWritten = writeBytesSerialPort(answer_test, 5);
-                totalFramesExchanged++;
+                bytesWritten = writeBytes(s, answer_test, 5);
+                s->totalFramesExchanged++;
 
                 if (bytesWritten == 5) {
-                    return 1;
+                    return s;
                 } else {
                     printf("Error while writing response test frame\n");
-                    closeSerialPort();
-                    return -1;
+                    closePort(s);
+                    freeSession(s);
+                    return NULL;
                 }
             }
         }
 
     }
-    
+
     printf("Error on recognizing role\n");
-    alarm(0);
-    closeSerialPort();
-    return -1;
+    closePort(s);
+    freeSession(s);
+    return NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // LLWRITE
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int llwrite(const unsigned char *buf, int bufSize) {
-
-    unsigned char frame[bufSize * 2 + 8];
-
-    unsigned char control_byte = 0;
-    unsigned char bcc2 = 0;
-
-    alarmCount = 0;
-    alarmSet = FALSE;
-
-    frame[0] = FLAG;
-    frame[1] = A_TRANS;
-    frame[2] = C_SEQ(sequenceNum);
-    frame[3] = A_TRANS ^ C_SEQ(sequenceNum);
-
-    int n = 4;
+// Outcome of a frame given to linkSubmit() by linkWrite()
+typedef struct {
+    int done;
+    int result;
+} WriteOutcome;
+
+static void writeDone(LinkSession *s, int result, void *context) {
+    WriteOutcome *outcome = context;
+    (void)s;
+
+    outcome->done = TRUE;
+    outcome->result = result;
+}
 
-    for (int i = 0; i < bufSize; i++) {
-        unsigned char current_byte = buf[i];
-
-        switch (current_byte) {
-            case ESCAPE:
-                frame[n] = ESCAPE; 
-                n++;
-                frame[n] = ESCAPE ^ 0x20; 
-                n++;
-                break;
-            case FLAG:
-                frame[n] = ESCAPE; 
-                n++;
-                frame[n] = FLAG ^ 0x20; 
-                n++;
-                break;
-            default:
-                frame[n] = current_byte; 
-                n++;
-                break;
-        }
+int linkWrite(LinkSession *s, const unsigned char *buf, int bufSize) {
 
-        bcc2 ^= current_byte;
+    // The receiver's linkRead() drops longer frames
+    if (bufSize > MAX_PAYLOAD_SIZE) {
+        return -1;
     }
 
-    if (bcc2 == FLAG) {
-        frame[n] = ESCAPE;
-        n++;
-        frame[n] = FLAG ^ 0x20;
-        n++;
-    } else if (bcc2 == ESCAPE) {
-        frame[n] = ESCAPE; 
-        n++;
-        frame[n] = ESCAPE ^ 0x20;
-        n++;
-    } else {
-        frame[n] = bcc2;
-        n++;
+    if (s->duplex) {
+        return linkWriteDuplex(s, buf, bufSize);
     }
 
-    frame[n] = FLAG;
-    n++;
-
-    int bytesWritten = 0;
-
-    sequenceNum = 1 - sequenceNum;
-
-    while (alarmCount < info.nRetransmissions) {
-
-        bytesWritten = writeBytesSerialPort(frame, n);;
-        totalFramesExchanged++;
-
-        if (bytesWritten == n) {
-                alarm(info.timeout);
-                alarmSet = TRUE;
-            } else {
-                printf("Error while writting frame\n");
-                closeSerialPort();
-                return -1;
-            }
-        
-        state = START;
-
-        while (alarmSet && state != STOP_STATE) {
+    // Queue the frame behind the ones already submitted, and wait for it
+    WriteOutcome outcome = {FALSE, -1};
 
-            int byteRead = readByteSerialPort(&byte);
-
-            if (byteRead > 0) {
-                switch (state) {
-                    case START:
-                        if (byte == FLAG) {
-                            state = FLAG_RCV;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    case FLAG_RCV:
-                        if (byte == A_TRANS) {
-                            state = A_RCV;
-                        } else if (byte != FLAG) {
-                            state = START;
-                        }
-                        break;
-                    case A_RCV:
-                        if (byte == C_RR(sequenceNum) || byte == C_REJ(1 - sequenceNum)) {
-                            control_byte = byte;
-                            state = C_RCV;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    case C_RCV:
-                        if (byte == (A_TRANS ^ control_byte)) {
-                            state = BCC_OK;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    case BCC_OK:
-                        if (byte == FLAG) {
-                            state = STOP_STATE;
-                        }
-                        break;
-                    default:
-                        break;
-                }
-            }
-        }
+    if (linkSubmit(s, buf, bufSize, writeDone, &outcome) < 0) {
+        return -1;
+    }
 
-        if (state == STOP_STATE && control_byte == C_RR(sequenceNum)) {
-            alarm(0);
-            printf("Packet exchanged successfully!\n");
-            return n;
-        }
+    while (!outcome.done) {
+        linkPoll(s, -1);
     }
-    return -1;
+
+    return outcome.result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int llread(unsigned char *packet) {
+// Add byte to the I-frame data linkRead has read so far (*n bytes). A frame
+// longer than any packet is dropped, so the transmitter times out on it.
+// Return FALSE if it was dropped.
+static int addFrameData(LinkSession *s, int *n, unsigned char byte) {
+    if (*n == sizeof(s->readData)) {
+        printf("\nError - Frame longer than a packet, dropped\n");
+        *n = 0;
+        s->state = START;
+        return FALSE;
+    }
+
+    s->readData[(*n)++] = byte;
+    return TRUE;
+}
+
+int linkRead(LinkSession *s, unsigned char *packet) {
     unsigned char bcc2 = 0;
     int bytesWritten = 0;
     int n = 0;
+    unsigned char control_byte = 0;
+
+    if (s->duplex) {
+        return linkReadDuplex(s, packet);
+    }
+
+    s->state = START;
 
-    state = START;
+    while (s->state != STOP_STATE) {
+        int byteRead = readByte(s, &s->byte);
 
-    while (state != STOP_STATE) {
-        int byteRead = readByteSerialPort(&byte);
+        if (byteRead < 0) {
+            printf("Error while reading the port\n");
+            return LINK_BROKEN;
+        }
 
         if (byteRead > 0) {
-            switch (state) {
+            switch (s->state) {
                 case START:
-                    if (byte == FLAG) {
-                        state = FLAG_RCV;
+                    if (s->byte == FLAG) {
+                        s->state = FLAG_RCV;
                     }
                     break;
                 case FLAG_RCV:
-                    if (byte == A_TRANS) {
-                        state = A_RCV;
-                    } else if (byte != FLAG) {
-                        state = START;
+                    if (s->byte == A_TRANS) {
+                        s->state = A_RCV;
+                    } else if (s->byte != FLAG) {
+                        s->state = START;
                     }
                     break;
                 case A_RCV:
-                    if (byte == C_SEQ(sequenceNum)) {
-                        state = C_RCV;
-                    } else if (byte == FLAG) {
-                        state = FLAG_RCV;
+                    if (s->byte == C_SEQ(s->sequenceNum) || s->byte == C_SEQ(1 - s->sequenceNum) || s->byte == C_SET) {
+                        control_byte = s->byte;
+                        s->state = C_RCV;
+                    } else if (s->byte == FLAG) {
+                        s->state = FLAG_RCV;
                     } else {
-                        state = START;
+                        s->state = START;
                     }
                     break;
                 case C_RCV:
-                    if (byte == (A_TRANS ^ C_SEQ(sequenceNum))) {
-                        state = BCC_OK;
-                    } else if (byte == FLAG) {
-                        state = FLAG_RCV;
+                    if (s->byte == (A_TRANS ^ control_byte)) {
+                        s->state = BCC_OK;
+                    } else if (s->byte == FLAG) {
+                        s->state = FLAG_RCV;
                     } else {
-                        state = START;
+                        s->state = START;
                     }
                     break;
                 case BCC_OK:
-                    if (byte == FLAG) {
-                        state = STOP_STATE;
-                    } else if (byte == ESCAPE) {
-                        state = ESCAPE_STATE;
-                    } else {
-                        packet[n] = byte; 
-                        n++;
-                        state = DATA_STATE;
+                    if (control_byte == C_SET) {
+                        // The transmitter is re-establishing the link after an outage
+                        if (s->byte == FLAG) {
+                            unsigned char ua[5] = {FLAG, A_TRANS, C_UA, A_TRANS ^ C_UA, FLAG};
+
+                            writeBytes(s, ua, 5);
+                            s->totalFramesExchanged++;
+                            printf("\nLink re-established by the transmitter\n");
+                        }
+                        s->state = START;
+                    } else if (s->byte == FLAG) {
+                        s->state = STOP_STATE;
+                    } else if (s->byte == ESCAPE) {
+                        s->state = ESCAPE_STATE;
+                    } else if (addFrameData(s, &n, s->byte)) {
+                        s->state = DATA_STATE;
                     }
                     break;
                 case DATA_STATE:
-                    if (byte == ESCAPE) {
-                        state = ESCAPE_STATE;
-                    } else if (byte == FLAG) {
-                        state = STOP_STATE;
+                    if (s->byte == ESCAPE) {
+                        s->state = ESCAPE_STATE;
+                    } else if (s->byte == FLAG) {
+                        s->state = STOP_STATE;
                         n--;
                     } else {
-                        packet[n] = byte; 
-                        n++;
+                        addFrameData(s, &n, s->byte);
                     }
                     break;
                 case ESCAPE_STATE:
-                    if (byte == (FLAG ^ 0x20)) {
-                        packet[n] = FLAG; 
-                        n++;
-                        state = DATA_STATE;
-                    } else if (byte == (ESCAPE ^ 0x20)) {
-                        packet[n] = ESCAPE; 
-                        n++;
-                        state = DATA_STATE;
+                    // XON and XOFF are only escaped with --flow=xonxoff
+                    if (s->byte == (FLAG ^ 0x20) || s->byte == (ESCAPE ^ 0x20) ||
+                        s->byte == (XON ^ 0x20) || s->byte == (XOFF ^ 0x20)) {
+                        if (addFrameData(s, &n, s->byte ^ 0x20)) {
+                            s->state = DATA_STATE;
+                        }
                     } else {
-                        state = START;
+                        s->state = START;
                     }
                     break;
                 default:
                     break;
             }
         }
+
+        if (s->state == STOP_STATE && control_byte != C_SEQ(s->sequenceNum)) {
+            // Retransmission of the previous frame, whose RR was lost: acknowledge it again
+            unsigned char answer[5] = {FLAG, A_TRANS, C_RR(s->sequenceNum), A_TRANS ^ C_RR(s->sequenceNum), FLAG};
+
+            writeBytes(s, answer, 5);
+            s->totalFramesExchanged++;
+
+            n = 0;
+            s->state = START;
+        }
     }
 
     for (int i = 0; i < n; i++) {
-        bcc2 ^= packet[i];
+        bcc2 ^= s->readData[i];
     }
 
-    if (bcc2 != packet[n]) {
+    if (bcc2 != s->readData[n]) {
         printf("\nError - Mismatch of the BCC2\n");
+        noteOverrun(s);
 
-        unsigned char answer[5] = {FLAG, A_TRANS, C_REJ(sequenceNum), A_TRANS ^ C_REJ(sequenceNum), FLAG};
+        unsigned char answer[5] = {FLAG, A_TRANS, C_REJ(s->sequenceNum), A_TRANS ^ C_REJ(s->sequenceNum), FLAG};
 
-        bytesWritten = writeBytesSerialPort(answer, 5);
-        totalFramesExchanged++;
+        bytesWritten = writeBytes(s, answer, 5);
+        s->totalFramesExchanged++;
 
         if (bytesWritten != 5) {
             printf("Error writing answer frame\n");
@@ -476,14 +847,15 @@ int llread(unsigned char *packet) {
 
         return -1;
     }
-    sequenceNum = 1 - sequenceNum;
+    s->sequenceNum = 1 - s->sequenceNum;
 
-    unsigned char answer[5] = {FLAG, A_TRANS, C_RR(sequenceNum), A_TRANS ^ C_RR(sequenceNum), FLAG};
+    unsigned char answer[5] = {FLAG, A_TRANS, C_RR(s->sequenceNum), A_TRANS ^ C_RR(s->sequenceNum), FLAG};
 
-    bytesWritten = writeBytesSerialPort(answer, 5);
-    totalFramesExchanged++;
+    bytesWritten = writeBytes(s, answer, 5);
+    s->totalFramesExchanged++;
 
     if (bytesWritten == 5) {
+        memcpy(packet, s->readData, n);
         printf("\nPacket read successfully!\n");
         return n;
     } else {
@@ -495,72 +867,80 @@ int llread(unsigned char *packet) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // LLCLOSE
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int llclose(int showStatistics) {
+int linkClose(LinkSession *s, int showStatistics) {
 
     printf("\nClosing serial port connection...\n");
 
     unsigned char disc[5] = {FLAG, A_TRANS, C_DISC, A_TRANS ^ C_DISC, FLAG};
     unsigned char ua[5] = {FLAG, A_TRANS, C_UA, A_TRANS ^ C_UA, FLAG};
 
-    alarmCount = 0;
-    state = START;
+    s->timeouts = 0;
+    s->state = START;
 
-    if (info.role == LlTx) {
+    if (s->info.role == LlTx) {
 
-        while (alarmCount < info.nRetransmissions) {
+        while (s->timeouts < s->info.nRetransmissions) {
 
-            int bytesWritten = writeBytesSerialPort(disc, 5);
-            totalFramesExchanged++;
+            int bytesWritten = writeBytes(s, disc, 5);
+            s->totalFramesExchanged++;
 
             if (bytesWritten == 5) {
-                alarm(info.timeout);
-                alarmSet = TRUE;
+                startTimer(s, s->info.timeout);
             } else {
                 perror("Error sending first DISC frame");
+                closePort(s);
+                freeSession(s);
                 return -1;
             }
 
-            while (alarmSet) {
+            while (timerRunning(s) && s->state != STOP_STATE) {
+
+                int bytesRead = readByte(s, &s->byte);
 
-                int bytesRead = readByteSerialPort(&byte);
+                if (bytesRead < 0) {
+                    printf("Error while reading the port\n");
+                    closePort(s);
+                    freeSession(s);
+                    return -1;
+                }
 
                 if (bytesRead > 0) {
-                    switch (state) {
+                    switch (s->state) {
                         case START:
-                            if (byte == FLAG) {
-                                state = FLAG_RCV;
+                            if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
                             }
                             break;
                         case FLAG_RCV:
-                            if (byte == A_TRANS) {
-                                state = A_RCV;
-                            } else if (byte != FLAG) {
-                                state = START;
+                            if (s->byte == A_TRANS) {
+                                s->state = A_RCV;
+                            } else if (s->byte != FLAG) {
+                                s->state = START;
                             }
                             break;
                         case A_RCV:
-                            if (byte == C_DISC) {
-                                state = C_RCV;
-                            } else if (byte == FLAG) {
-                                state = FLAG_RCV;
+                            if (s->byte == C_DISC) {
+                                s->state = C_RCV;
+                            } else if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         case C_RCV:
-                            if (byte == (A_TRANS ^ C_DISC)) {
-                                state = BCC_OK;
-                            } else if (byte == FLAG) {
-                                state = FLAG_RCV;
+                            if (s->byte == (A_TRANS ^ C_DISC)) {
+                                s->state = BCC_OK;
+                            } else if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         case BCC_OK:
-                            if (byte == FLAG) {
-                                state = STOP_STATE;
+                            if (s->byte == FLAG) {
+                                s->state = STOP_STATE;
                             } else {
-                                state = START;
+                                s->state = START;
                             }
                             break;
                         default:
@@ -569,70 +949,83 @@ int llclose(int showStatistics) {
                 }
             }
 
-            if (state == STOP_STATE) {
-                alarm(0);
-                alarmSet = FALSE;
+            if (s->state == STOP_STATE) {
+                stopTimer(s);
                 break;
             }
         }
 
-        if (state != STOP_STATE) {
+        if (s->state != STOP_STATE) {
             printf("Failed to receive second DISC frame\n");
+            closePort(s);
+            freeSession(s);
             return -1;
         }
 
-        int bytesWritten = writeBytesSerialPort(ua, 5);
-        totalFramesExchanged++;
+        int bytesWritten = writeBytes(s, ua, 5);
+        s->totalFramesExchanged++;
 
         if (bytesWritten != 5) {
             perror("Error sending final UA frame");
+            closePort(s);
+            freeSession(s);
             return -1;
         }
 
-    } else if (info.role == LlRx) {
-        
-        while (state != STOP_STATE) {
+    } else if (s->info.role == LlRx) {
+
+        if (s->disc) {
+            s->state = STOP_STATE;
+        }
+
+        while (s->state != STOP_STATE) {
+
+            int bytesRead = readByte(s, &s->byte);
 
-            int bytesRead = readByteSerialPort(&byte);
+            if (bytesRead < 0) {
+                printf("Error while reading the port\n");
+                closePort(s);
+                freeSession(s);
+                return -1;
+            }
 
             if (bytesRead > 0) {
-                switch (state) {
+                switch (s->state) {
                     case START:
-                        if (byte == FLAG) {
-                            state = FLAG_RCV;
+                        if (s->byte == FLAG) {
+                            s->state = FLAG_RCV;
                         }
                         break;
                     case FLAG_RCV:
-                        if (byte == A_TRANS) {
-                            state = A_RCV;
-                        } else if (byte != FLAG) {
-                            state = START;
+                        if (s->byte == A_TRANS) {
+                            s->state = A_RCV;
+                        } else if (s->byte != FLAG) {
+                            s->state = START;
                         }
                         break;
                     case A_RCV:
-                        if (byte == C_DISC) {
-                            state = C_RCV;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
+                        if (s->byte == C_DISC) {
+                            s->state = C_RCV;
+                        } else if (s->byte == FLAG) {
+                            s->state = FLAG_RCV;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     case C_RCV:
-                        if (byte == (A_TRANS ^ C_DISC)) {
-                            state = BCC_OK;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
+                        if (s->byte == (A_TRANS ^ C_DISC)) {
+                            s->state = BCC_OK;
+                        } else if (s->byte == FLAG) {
+                            s->state = FLAG_RCV;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     case BCC_OK:
-                        if (byte == FLAG) {
-                            state = STOP_STATE;
-                            alarmSet = FALSE;
+                        if (s->byte == FLAG) {
+                            s->state = STOP_STATE;
                         } else {
-                            state = START;
+                            s->state = START;
                         }
                         break;
                     default:
@@ -641,81 +1034,966 @@ int llclose(int showStatistics) {
             }
         }
 
-        if (state != STOP_STATE) {
-            printf("Failed to receive first DISC frame\n");
-            return -1;
-        }
+        s->timeouts = 0;
 
-        int bytesWritten = writeBytesSerialPort(disc, 5);;
-        totalFramesExchanged++;
+        // Send DISC again if the UA doesn't come, instead of waiting forever
+        while (s->timeouts < s->info.nRetransmissions) {
 
-        if (bytesWritten != 5) {
-            perror("Error sending second DISC frame");
-            return -1;
-        }
+            int bytesWritten = writeBytes(s, disc, 5);
+            s->totalFramesExchanged++;
 
-        state = START;
+            if (bytesWritten == 5) {
+                startTimer(s, s->info.timeout);
+            } else {
+                perror("Error sending second DISC frame");
+                closePort(s);
+                freeSession(s);
+                return -1;
+            }
 
-        while (state != STOP_STATE) {
+            s->state = START;
 
-            int byteRead = readByteSerialPort(&byte);
+            while (timerRunning(s) && s->state != STOP_STATE) {
 
-            if (byteRead > 0) {
-                switch (state) {
-                    case START:
-                        if (byte == FLAG) {
-                            state = FLAG_RCV;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    case FLAG_RCV:
-                        if (byte == A_TRANS) {
-                            state = A_RCV;
-                        } else if (byte != FLAG) {
-                            state = START;
-                        }
-                        break;
-                    case A_RCV:
-                        if (byte == C_UA) {
-                            state = C_RCV;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    case C_RCV:
-                        if (byte == (A_TRANS ^ C_UA)) {
-                            state = BCC_OK;
-                        } else if (byte == FLAG) {
-                            state = FLAG_RCV;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    case BCC_OK:
-                        if (byte == FLAG) {
-                            state = STOP_STATE;
-                        } else {
-                            state = START;
-                        }
-                        break;
-                    default:
-                        break;
-                }
-            }
-        }
-    }
+                int byteRead = readByte(s, &s->byte);
 
-    if (showStatistics) {
-        printf("\n-----------------------------------------\n");
-        printf("Statistics:\n");
-        printf("\nTotal number of frames exchanged successfully: %d\n", totalFramesExchanged);
-        printf("Total number of retries needed: %d\n", retries);
-        printf("\n-----------------------------------------\n");
-    }
+                if (byteRead < 0) {
+                    printf("Error while reading the port\n");
+                    closePort(s);
+                    freeSession(s);
+                    return -1;
+                }
 
-    int closed = closeSerialPort();
-    return closed;
+                if (byteRead > 0) {
+                    switch (s->state) {
+                        case START:
+                            if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
+                            } else {
+                                s->state = START;
+                            }
+                            break;
+                        case FLAG_RCV:
+                            if (s->byte == A_TRANS) {
+                                s->state = A_RCV;
+                            } else if (s->byte != FLAG) {
+                                s->state = START;
+                            }
+                            break;
+                        case A_RCV:
+                            if (s->byte == C_UA) {
+                                s->state = C_RCV;
+                            } else if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
+                            } else {
+                                s->state = START;
+                            }
+                            break;
+                        case C_RCV:
+                            if (s->byte == (A_TRANS ^ C_UA)) {
+                                s->state = BCC_OK;
+                            } else if (s->byte == FLAG) {
+                                s->state = FLAG_RCV;
+                            } else {
+                                s->state = START;
+                            }
+                            break;
+                        case BCC_OK:
+                            if (s->byte == FLAG) {
+                                s->state = STOP_STATE;
+                            } else {
+                                s->state = START;
+                            }
+                            break;
+                        default:
+                            break;
+                    }
+                }
+            }
+
+            if (s->state == STOP_STATE) {
+                stopTimer(s);
+                break;
+            }
+        }
+
+        if (s->state != STOP_STATE) {
+            printf("Failed to receive final UA frame\n");
+            closePort(s);
+            freeSession(s);
+            return -1;
+        }
+    }
+
+    if (showStatistics) {
+        printf("\n-----------------------------------------\n");
+        printf("Statistics:\n");
+        printf("\nTotal number of frames exchanged successfully: %d\n", s->totalFramesExchanged);
+        printf("Total number of retries needed: %d\n", s->retries);
+
+        if (options.duplex) {
+            printf("Acknowledgements piggybacked on I-frames: %u\n", s->piggybackedAcks);
+            printf("Acknowledgements sent in RR frames: %u\n", s->standaloneAcks);
+        }
+
+        if (options.reconnect) {
+            printf("Number of link outages: %u\n", s->outages);
+            printf("Total outage time: %.3f s\n", s->outageTime);
+            printf("Total recovery latency: %.3f s\n", s->recoveryLatency);
+        }
+
+        if (s->overrunsAtOpen >= 0) {
+            printf("Receive overruns of the serial port: %d\n",
+                   s->transport->ops->overruns(s->transport) - s->overrunsAtOpen);
+            printf("Retries caused by overruns: %u\n", s->overrunErrors);
+        }
+
+        printTurnaround(s);
+        printf("\n-----------------------------------------\n");
+    }
+
+    int closed = closePort(s);
+    freeSession(s);
+    return closed;
+}
+
+void linkAbort(LinkSession *s) {
+    closePort(s);
+    freeSession(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FULL DUPLEX
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// A reader thread owns the serial port input. It hands each new I-frame to
+// linkRead and wakes linkWrite when its frame is acknowledged. An I-frame is
+// only acknowledged once linkRead takes it, so a slow reader holds the other
+// end back. The acknowledgement rides in the N(R) bit of the next I-frame we
+// send if that goes out within ACK_DELAY, otherwise the ack timer thread sends
+// an RR frame. N(R) is always read under writeLock, right before the frame
+// goes out, so the other end never sees it go backwards.
+
+// Write an I-frame built by buildFrame, carrying the current N(R).
+static int writeIFrame(LinkSession *s, unsigned char *frame, int n) {
+    pthread_mutex_lock(&s->writeLock);
+    pthread_mutex_lock(&s->lock);
+
+    frame[2] = C_SEQ(s->sendSeq) | C_NR(s->recvSeq);
+    frame[3] = A_TRANS ^ frame[2];
+
+    if (s->ackPending) {
+        s->ackPending = FALSE;
+        s->piggybackedAcks++;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    int bytesWritten = writeBytes(s, frame, n);
+    s->totalFramesExchanged++;
+    pthread_mutex_unlock(&s->writeLock);
+
+    return bytesWritten == n ? n : -1;
+}
+
+static void writeSupervisionFrame(LinkSession *s, unsigned char control) {
+    unsigned char frame[5] = {FLAG, A_TRANS, control, A_TRANS ^ control, FLAG};
+
+    if (writeBytes(s, frame, 5) != 5) {
+        printf("Error writing answer frame\n");
+    }
+    s->totalFramesExchanged++;
+}
+
+// Send RR(N(R)) now, in a frame of its own.
+static void writeAck(LinkSession *s) {
+    pthread_mutex_lock(&s->writeLock);
+    pthread_mutex_lock(&s->lock);
+
+    unsigned char control = C_RR(s->recvSeq);
+    s->ackPending = FALSE;
+    s->standaloneAcks++;
+
+    pthread_mutex_unlock(&s->lock);
+
+    writeSupervisionFrame(s, control);
+    pthread_mutex_unlock(&s->writeLock);
+}
+
+static void writeReject(LinkSession *s, int seq) {
+    pthread_mutex_lock(&s->writeLock);
+    writeSupervisionFrame(s, C_REJ(seq));
+    pthread_mutex_unlock(&s->writeLock);
+}
+
+// Handle one frame (address, control, BCC1 and data, after destuffing) read
+// by the reader thread.
+static void handleFrame(LinkSession *s, const unsigned char *frame, int n) {
+
+    if (n < 3 || frame[0] != A_TRANS || frame[2] != (frame[0] ^ frame[1])) {
+        return;
+    }
+
+    unsigned char control = frame[1];
+    int isIFrame = (control & ~(C_SEQ(1) | C_NR(1))) == 0 && n >= 4;
+
+    pthread_mutex_lock(&s->lock);
+
+    // An I-frame's N(R) acknowledges our frame just like an RR frame
+    if (control == C_RR(1 - s->sendSeq) || (isIFrame && (control & C_NR(1)) == C_NR(1 - s->sendSeq))) {
+        s->acked = TRUE;
+        pthread_cond_broadcast(&s->changed);
+    } else if (control == C_REJ(s->sendSeq)) {
+        s->rejected = TRUE;
+        pthread_cond_broadcast(&s->changed);
+    } else if (control == C_DISC && s->info.role == LlRx) {
+        // The transmitter left full-duplex mode a moment before we did
+        s->disc = TRUE;
+    } else if (control == C_SET) {
+        pthread_mutex_unlock(&s->lock);
+        pthread_mutex_lock(&s->writeLock);
+        writeSupervisionFrame(s, C_UA);
+        pthread_mutex_unlock(&s->writeLock);
+        return;
+    }
+
+    if (isIFrame) {
+        int seq = (control & C_SEQ(1)) != 0;
+        int size = n - 4;
+        unsigned char bcc2 = 0;
+
+        for (int i = 0; i < size; i++) {
+            bcc2 ^= frame[3 + i];
+        }
+
+        if (size > MAX_PAYLOAD_SIZE) {
+            // Longer than linkRead's packet: the transmitter times out on it
+            pthread_mutex_unlock(&s->lock);
+            printf("\nError - Frame longer than a packet, dropped\n");
+            return;
+        }
+
+        if (seq != s->recvSeq) {
+            // Retransmission of a frame whose acknowledgement was lost
+            pthread_mutex_unlock(&s->lock);
+            writeAck(s);
+            return;
+        }
+
+        if (!s->receivedReady) {
+            if (bcc2 != frame[n - 1]) {
+                noteOverrun(s);
+                pthread_mutex_unlock(&s->lock);
+                printf("\nError - Mismatch of the BCC2\n");
+                writeReject(s, seq);
+                return;
+            }
+
+            memcpy(s->received, frame + 3, size);
+            s->receivedSize = size;
+            s->receivedReady = TRUE;
+            pthread_cond_broadcast(&s->changed);
+        }
+        // Otherwise this is the frame linkRead hasn't taken yet, sent again
+    }
+
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *readerThread(void *arg) {
+    LinkSession *s = arg;
+    unsigned char c;
+
+    s->frameSize = 0;
+
+    while (TRUE) {
+
+        int n = readByte(s, &c);
+
+        if (n < 0) {
+            // Nothing more will come: wake linkRead to report it
+            pthread_mutex_lock(&s->lock);
+            s->broken = TRUE;
+            pthread_cond_broadcast(&s->changed);
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+
+        // Stop only while the line is idle, never in the middle of a frame
+        if (n == 0) {
+            if (s->stopping) {
+                break;
+            }
+            continue;
+        }
+
+        parseByte(s, c, handleFrame);
+    }
+
+    return NULL;
+}
+
+// Send the pending acknowledgement in an RR frame once ACK_DELAY runs out.
+static void *ackTimerThread(void *arg) {
+    LinkSession *s = arg;
+
+    pthread_mutex_lock(&s->lock);
+
+    while (!s->stopping) {
+
+        if (!s->ackPending) {
+            pthread_cond_wait(&s->changed, &s->lock);
+        } else if (pthread_cond_timedwait(&s->changed, &s->lock, &s->ackDeadline) == ETIMEDOUT && s->ackPending) {
+            pthread_mutex_unlock(&s->lock);
+            writeAck(s);
+            pthread_mutex_lock(&s->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static int linkWriteDuplex(LinkSession *s, const unsigned char *buf, int bufSize) {
+
+    QueuedFrame *f = takeFrame(s, bufSize);
+
+    if (!f) {
+        return -1;
+    }
+
+    unsigned char *frame = f->frame;
+    int n = buildFrame(frame, C_SEQ(s->sendSeq), buf, bufSize);
+    int attempts = 0;
+
+    pthread_mutex_lock(&s->lock);
+    s->acked = FALSE;
+    s->rejected = FALSE;
+    s->writing = TRUE;
+
+    while (attempts < s->info.nRetransmissions) {
+        pthread_mutex_unlock(&s->lock);
+
+        if (writeIFrame(s, frame, n) < 0) {
+            printf("Error while writting frame\n");
+            pthread_mutex_lock(&s->lock);
+            break;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += s->info.timeout;
+
+        pthread_mutex_lock(&s->lock);
+
+        int waited = 0;
+        while (!s->acked && !s->rejected && waited != ETIMEDOUT) {
+            waited = pthread_cond_timedwait(&s->changed, &s->lock, &deadline);
+        }
+
+        if (s->acked) {
+            s->sendSeq = 1 - s->sendSeq;
+            s->writing = FALSE;
+            s->lastWriteTime = linkTime();
+            pthread_mutex_unlock(&s->lock);
+
+            s->lastAckTime = s->lastWriteTime;
+            printf("Packet exchanged successfully!\n");
+            releaseFrame(s, f);
+            return n;
+        }
+
+        if (s->rejected) {
+            s->rejected = FALSE;
+        } else {
+            attempts++;
+            printf("\nCouldn't receive frame in time - Retrying...\n");
+        }
+        s->retries++;
+    }
+
+    s->writing = FALSE;
+    pthread_mutex_unlock(&s->lock);
+    releaseFrame(s, f);
+    return -1;
+}
+
+static int linkReadDuplex(LinkSession *s, unsigned char *packet) {
+
+    pthread_mutex_lock(&s->lock);
+
+    while (!s->receivedReady && !s->broken) {
+        pthread_cond_wait(&s->changed, &s->lock);
+    }
+
+    if (!s->receivedReady) {
+        pthread_mutex_unlock(&s->lock);
+        printf("Error while reading the port\n");
+        return LINK_BROKEN;
+    }
+
+    int n = s->receivedSize;
+    memcpy(packet, s->received, n);
+
+    s->receivedReady = FALSE;
+    s->recvSeq = 1 - s->recvSeq;
+
+    // Wait for one of our I-frames to carry the acknowledgement if one is
+    // coming soon: we are between frames, or waiting for our own frame's
+    // acknowledgement, which the receiver role sends without delay (so the
+    // two ends never both wait for each other)
+    int delay = (!s->writing && linkTime() - s->lastWriteTime < ACK_DELAY) || (s->writing && s->info.role == LlTx);
+
+    if (delay) {
+        clock_gettime(CLOCK_MONOTONIC, &s->ackDeadline);
+        s->ackDeadline.tv_nsec += ACK_DELAY * 1e9;
+
+        if (s->ackDeadline.tv_nsec >= 1000000000) {
+            s->ackDeadline.tv_sec++;
+            s->ackDeadline.tv_nsec -= 1000000000;
+        }
+
+        s->ackPending = TRUE;
+        pthread_cond_broadcast(&s->changed);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    if (!delay) {
+        writeAck(s);
+    }
+
+    printf("\nPacket read successfully!\n");
+    return n;
+}
+
+int linkStartDuplex(LinkSession *s) {
+
+    // Both ends agree on sequenceNum, so each direction starts from it
+    s->startSeq = s->sequenceNum;
+    s->sendSeq = s->sequenceNum;
+    s->recvSeq = s->sequenceNum;
+    s->receivedReady = FALSE;
+    s->ackPending = FALSE;
+    s->stopping = FALSE;
+
+    if (pthread_create(&s->reader, NULL, readerThread, s) != 0) {
+        printf("Failed to start the link reader thread\n");
+        return -1;
+    }
+
+    if (pthread_create(&s->ackTimer, NULL, ackTimerThread, s) != 0) {
+        printf("Failed to start the acknowledgement timer thread\n");
+        s->stopping = TRUE;
+        pthread_join(s->reader, NULL);
+        return -1;
+    }
+
+    s->duplex = TRUE;
+    return 0;
+}
+
+void linkStopDuplex(LinkSession *s) {
+
+    if (!s->duplex) {
+        return;
+    }
+
+    // No I-frame is coming to carry it anymore
+    if (s->ackPending) {
+        writeAck(s);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->stopping = TRUE;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_join(s->reader, NULL);
+    pthread_join(s->ackTimer, NULL);
+    s->duplex = FALSE;
+
+    // Both ends have sent and received the same frames in total, so they
+    // agree on the half-duplex sequence number again
+    s->sequenceNum = s->startSeq ^ s->sendSeq ^ s->recvSeq;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// EVENT LOOP
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// A session driven by an event loop never waits for the other end. Frames
+// given to linkSubmit() go out one at a time, stop-and-wait just like in
+// linkWrite, each once the previous one is acknowledged; linkProcessInput()
+// and linkProcessTimer() move the queue along. Frames read are acknowledged
+// just like in linkRead, so the other end may be a blocking session.
+
+// Take the frame at the head of the queue out of it.
+static QueuedFrame *popQueued(LinkSession *s) {
+    QueuedFrame *f = s->queueHead;
+
+    s->queueHead = f->next;
+    if (!s->queueHead) {
+        s->queueTail = NULL;
+    }
+    s->queued--;
+
+    return f;
+}
+
+// Report every queued frame as failed: the other end has lost track of our
+// sequence number.
+static void failQueued(LinkSession *s) {
+    stopTimer(s);
+    s->inFlight = FALSE;
+    s->sending = FALSE;
+    s->reconnecting = FALSE;
+
+    while (s->queueHead) {
+        QueuedFrame *f = popQueued(s);
+
+        s->completed++;
+        if (f->done) {
+            f->done(s, -1, f->context);
+        }
+        releaseFrame(s, f);
+    }
+}
+
+// Count an ACK turnaround of seconds in its histogram bucket.
+static void recordTurnaround(LinkSession *s, double seconds) {
+    int bucket = 0;
+
+    for (double us = seconds * 1e6; us >= 2 && bucket < TURNAROUND_BUCKETS - 1; us /= 2) {
+        bucket++;
+    }
+    s->turnaround[bucket]++;
+}
+
+// Print the ACK turnaround histogram, if any frame was acknowledged.
+static void printTurnaround(LinkSession *s) {
+    unsigned int total = 0;
+    unsigned int largest = 0;
+
+    for (int i = 0; i < TURNAROUND_BUCKETS; i++) {
+        total += s->turnaround[i];
+        largest = s->turnaround[i] > largest ? s->turnaround[i] : largest;
+    }
+
+    if (total == 0) {
+        return;
+    }
+
+    printf("ACK turnaround (writing an I-frame to reading its RR):\n");
+
+    for (int i = 0; i < TURNAROUND_BUCKETS; i++) {
+        if (s->turnaround[i] == 0) {
+            continue;
+        }
+
+        char bar[41];
+        int width = (int) ((double) s->turnaround[i] * 40 / largest);
+
+        memset(bar, '#', width);
+        bar[width] = '\0';
+
+        if (i == TURNAROUND_BUCKETS - 1) {
+            printf("  >= %8lu us  %6u %s\n", 1UL << i, s->turnaround[i], bar);
+        } else {
+            printf("  < %9lu us  %6u %s\n", 1UL << (i + 1), s->turnaround[i], bar);
+        }
+    }
+}
+
+// Write as much of the frame at the head of the queue as the transport takes
+// now, keeping track of the rest (see linkProcessOutput()).
+// Return "-1" on error (failing the queued frames).
+static int transmitQueued(LinkSession *s) {
+    QueuedFrame *f = s->queueHead;
+    int n = s->transport->ops->write(s->transport, f->frame + f->sent, f->size - f->sent);
+
+    if (n < 0) {
+        printf("Error while writting frame\n");
+        failQueued(s);
+        return -1;
+    }
+
+    f->sent += n;
+    s->sending = f->sent < f->size;
+    return 0;
+}
+
+// (Re)send the frame at the head of the queue and start its timer.
+static void writeQueued(LinkSession *s) {
+    QueuedFrame *f = s->queueHead;
+
+    if (s->sending) {
+        // Still going out, held back by the transport: give it another
+        // timeout rather than cutting it short
+        startTimer(s, s->info.timeout);
+        return;
+    }
+
+    s->totalFramesExchanged++;
+    s->sentTime = linkTime();
+    f->sent = 0;
+
+    startTimer(s, s->info.timeout);
+    transmitQueued(s);
+}
+
+// Once the frame in flight runs out of retries, keep sending SET frames,
+// backing off exponentially, until the receiver answers with UA (see
+// linkReestablished()). Sends one SET per timer expiry, so an event loop keeps
+// serving its other links meanwhile. Sequence numbers are left untouched so
+// the transfer can resume.
+// Return FALSE once options.reconnectLimit seconds pass.
+static int reconnectStep(LinkSession *s) {
+    double now = linkTime();
+
+    if (!s->reconnecting) {
+        printf("\nLink lost - trying to reconnect...\n");
+        s->reconnecting = TRUE;
+        s->reconnectStart = now;
+        s->backoff = 1;
+    } else if (s->backoff < MAX_RECONNECT_BACKOFF) {
+        s->backoff *= 2;
+    }
+
+    if (options.reconnectLimit != 0 && now - s->reconnectStart >= options.reconnectLimit) {
+        printf("Reconnecting failed - Link down for too long\n");
+        s->reconnecting = FALSE;
+        return FALSE;
+    }
+
+    // A frame still held back by the transport must go out whole first
+    if (!s->sending) {
+        writeSupervisionFrame(s, C_SET);
+    }
+    startTimer(s, s->backoff);
+    return TRUE;
+}
+
+// The link answered while reconnecting: give the frame in flight a fresh set
+// of retries.
+static void linkReestablished(LinkSession *s) {
+    stopTimer(s);
+    s->reconnecting = FALSE;
+    s->timeouts = 0;
+
+    s->linkBackTime = linkTime();
+    s->outages++;
+    s->outageTime += s->linkBackTime - s->lastAckTime;
+
+    printf("Link re-established!\n");
+}
+
+// Send the frame at the head of the queue, unless one is waiting for its acknowledgement.
+static void sendQueued(LinkSession *s) {
+    QueuedFrame *f = s->queueHead;
+
+    if (s->inFlight || !f) {
+        return;
+    }
+
+    f->frame[2] = C_SEQ(s->sequenceNum);
+    f->frame[3] = A_TRANS ^ f->frame[2];
+    s->sequenceNum = 1 - s->sequenceNum;
+
+    s->inFlight = TRUE;
+    s->timeouts = 0;
+    writeQueued(s);
+}
+
+// Handle one frame (address, control, BCC1 and data, after destuffing) read
+// by linkProcessInput().
+static void handleQueuedFrame(LinkSession *s, const unsigned char *frame, int n) {
+
+    if (n < 3 || frame[0] != A_TRANS || frame[2] != (frame[0] ^ frame[1])) {
+        return;
+    }
+
+    unsigned char control = frame[1];
+
+    if (s->inFlight && !s->sending && control == C_RR(s->sequenceNum)) {
+        QueuedFrame *f = popQueued(s);
+
+        if (s->reconnecting) {
+            // The RR of the frame itself, held up by the outage
+            linkReestablished(s);
+        }
+
+        stopTimer(s);
+        s->inFlight = FALSE;
+        s->completed++;
+        s->lastAckTime = linkTime();
+        recordTurnaround(s, s->lastAckTime - s->sentTime);
+
+        if (s->linkBackTime > 0) {
+            s->recoveryLatency += s->lastAckTime - s->linkBackTime;
+            s->linkBackTime = 0;
+        }
+
+        printf("Packet exchanged successfully!\n");
+
+        if (f->done) {
+            f->done(s, f->size, f->context);
+        }
+        releaseFrame(s, f);
+
+        sendQueued(s);
+    } else if (s->reconnecting && control == C_UA) {
+        linkReestablished(s);
+        writeQueued(s);
+    } else if (s->inFlight && control == C_REJ(1 - s->sequenceNum)) {
+        s->retries++;
+        writeQueued(s);
+    } else if ((control == C_SEQ(0) || control == C_SEQ(1)) && n >= 4 && s->packetHandler) {
+        // Without a handler (linkWrite), I-frames are left for linkRead()
+        const unsigned char *data = frame + 3;
+        int size = n - 4;
+        unsigned char bcc2 = 0;
+
+        if (control != C_SEQ(s->sequenceNum)) {
+            // Retransmission of the previous frame, whose RR was lost: acknowledge it again
+            writeSupervisionFrame(s, C_RR(s->sequenceNum));
+            return;
+        }
+
+        for (int i = 0; i < size; i++) {
+            bcc2 ^= data[i];
+        }
+
+        if (bcc2 != data[size]) {
+            noteOverrun(s);
+            printf("\nError - Mismatch of the BCC2\n");
+            writeSupervisionFrame(s, C_REJ(s->sequenceNum));
+            return;
+        }
+
+        s->sequenceNum = 1 - s->sequenceNum;
+        writeSupervisionFrame(s, C_RR(s->sequenceNum));
+        printf("\nPacket read successfully!\n");
+
+        if (s->packetHandler) {
+            s->packetHandler(s, data, size, s->handlerContext);
+        }
+    } else if (control == C_SET) {
+        // The transmitter is re-establishing the link after an outage
+        writeSupervisionFrame(s, C_UA);
+    } else if (control == C_DISC && s->info.role == LlRx) {
+        // The transmitter is closing the link, see linkClose()
+        s->disc = TRUE;
+    }
+}
+
+int linkFd(LinkSession *s) {
+    return s->transport->ops->pollFd(s->transport);
+}
+
+int linkSubmit(LinkSession *s, const unsigned char *buf, int bufSize, LinkWriteDone done, void *context) {
+
+    // The receiver drops frames with more data (and BCC2) than MAX_FRAME_DATA
+    if (s->duplex || bufSize >= MAX_FRAME_DATA) {
+        return -1;
+    }
+
+    QueuedFrame *f = takeFrame(s, bufSize);
+
+    if (!f) {
+        return -1;
+    }
+
+    f->done = done;
+    f->context = context;
+    f->size = buildFrame(f->frame, 0, buf, bufSize);
+
+    if (s->queueTail) {
+        s->queueTail->next = f;
+    } else {
+        s->queueHead = f;
+    }
+    s->queueTail = f;
+    s->queued++;
+
+    sendQueued(s);
+    return 0;
+}
+
+void linkSetPacketHandler(LinkSession *s, LinkPacketHandler handler, void *context) {
+    s->packetHandler = handler;
+    s->handlerContext = context;
+}
+
+int linkPending(LinkSession *s) {
+    return s->queued;
+}
+
+int linkOutputPending(LinkSession *s) {
+    return s->sending;
+}
+
+int linkWriteFd(LinkSession *s) {
+    return s->transport->ops->writeFd(s->transport);
+}
+
+int linkProcessOutput(LinkSession *s) {
+    return s->sending ? transmitQueued(s) : 0;
+}
+
+int linkProcessInput(LinkSession *s) {
+    unsigned char bytes[MAX_PAYLOAD_SIZE];
+
+    int n = readBytes(s, bytes, sizeof(bytes), FALSE);
+
+    if (n < 0) {
+        failQueued(s);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        parseByte(s, bytes[i], handleQueuedFrame);
+    }
+
+    return n;
+}
+
+int linkClosing(LinkSession *s) {
+    return s->disc;
+}
+
+double linkProcessTimer(LinkSession *s) {
+
+    if (!s->inFlight) {
+        return -1;
+    }
+
+    if (!timerRunning(s)) {
+        // Once out of retries, optionally wait for the link to come back and
+        // send the same frame again
+        if (s->timeouts < s->info.nRetransmissions && !s->reconnecting) {
+            writeQueued(s);
+        } else if (!s->reconnect || !reconnectStep(s)) {
+            printf("Sending frame failed - Too many attempts\n");
+            failQueued(s);
+        }
+
+        if (!s->inFlight) {
+            return -1;
+        }
+    }
+
+    double left = s->deadline - linkTime();
+    return left > 0 ? left : 0;
+}
+
+int linkPoll(LinkSession *s, double seconds) {
+    double end = linkTime() + seconds;
+    int completed = s->completed;
+
+    while (s->queued > 0 && s->completed == completed) {
+        double wait = linkProcessTimer(s);
+
+        if (s->completed != completed) {
+            break;
+        }
+
+        if (seconds >= 0 && (wait < 0 || end - linkTime() < wait)) {
+            wait = end - linkTime() > 0 ? end - linkTime() : 0;
+        }
+
+        // Without a file descriptor to wait on, the read below waits instead
+        int fd = linkFd(s);
+        int writeFd = s->sending ? linkWriteFd(s) : -1;
+
+        if (s->sending && writeFd < 0 && linkProcessOutput(s) < 0) {
+            return -1;
+        }
+
+        if (s->inputStart == s->inputEnd && fd >= 0) {
+            // poll() skips the second one while nothing waits to be written
+            struct pollfd p[2] = {{.fd = fd, .events = POLLIN}, {.fd = writeFd, .events = POLLOUT}};
+
+            // Round up, so the timer has run out when we wake up
+            int ready = poll(p, 2, wait < 0 ? -1 : (int) (wait * 1000) + 1);
+
+            if (ready < 0 && errno != EINTR) {
+                failQueued(s);
+                return -1;
+            }
+
+            if (ready > 0 && p[1].revents && linkProcessOutput(s) < 0) {
+                return -1;
+            }
+
+            if (ready <= 0 || !p[0].revents) {
+                if (seconds >= 0 && linkTime() >= end) {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        unsigned char bytes[MAX_PAYLOAD_SIZE];
+        int n = readBytes(s, bytes, sizeof(bytes), fd < 0 && seconds != 0);
+
+        if (n < 0) {
+            failQueued(s);
+            return -1;
+        }
+
+        // Stop at the frame that completes one of ours: what follows may be
+        // for linkRead()
+        int i = 0;
+
+        while (i < n && s->completed == completed) {
+            parseByte(s, bytes[i++], handleQueuedFrame);
+        }
+
+        memcpy(s->input, bytes + i, n - i);
+        s->inputStart = 0;
+        s->inputEnd = n - i;
+
+        if (seconds >= 0 && linkTime() >= end) {
+            break;
+        }
+    }
+
+    return s->queued;
+}
+
+void linkSetReconnect(LinkSession *s, int reconnect) {
+    s->reconnect = reconnect;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DEFAULT SESSION
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LinkSession *linkDefault() {
+    return defaultSession;
+}
+
+int llopen(LinkLayer connectionParameters) {
+    defaultSession = linkOpen(connectionParameters);
+    return defaultSession ? 1 : -1;
+}
+
+int llwrite(const unsigned char *buf, int bufSize) {
+    return linkWrite(defaultSession, buf, bufSize);
+}
+
+int llread(unsigned char *packet) {
+    return linkRead(defaultSession, packet);
+}
+
+int llclose(int showStatistics) {
+    int closed = linkClose(defaultSession, showStatistics);
+    defaultSession = NULL;
+    return closed;
+}
+
+int duplexStart() {
+    return linkStartDuplex(defaultSession);
+}
+
+void duplexStop() {
+    linkStopDuplex(defaultSession);
 }
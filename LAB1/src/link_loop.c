@@ -0,0 +1,242 @@
+// Link event loop implementation
+
+#include "link_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+// Most ready serial ports handled per wait
+#define MAX_EVENTS 64
+
+struct LinkLoop {
+    int epollFd;
+
+    LinkSession **sessions;
+    int *writing;       // Also waiting for sessions[i]'s port to be writable
+    int nSessions;
+    int capacity;
+
+    int changed;    // Sessions were added or removed since the flag was cleared
+    int stopped;
+};
+
+LinkLoop *loopCreate() {
+
+    LinkLoop *loop = calloc(1, sizeof(LinkLoop));
+
+    if (!loop) {
+        return NULL;
+    }
+
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (loop->epollFd < 0) {
+        perror("epoll_create1");
+        free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+// Return the index of session in loop->sessions, or -1 if the loop doesn't drive it.
+static int findSession(LinkLoop *loop, LinkSession *session) {
+    for (int i = 0; i < loop->nSessions; i++) {
+        if (loop->sessions[i] == session) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int loopAdd(LinkLoop *loop, LinkSession *session) {
+
+    if (linkFd(session) < 0) {
+        printf("This transport can't be driven by an event loop\n");
+        return -1;
+    }
+
+    if (loop->nSessions == loop->capacity) {
+        int capacity = loop->capacity ? loop->capacity * 2 : 8;
+        LinkSession **sessions = realloc(loop->sessions, capacity * sizeof(LinkSession *));
+
+        if (!sessions) {
+            return -1;
+        }
+        loop->sessions = sessions;
+
+        int *writing = realloc(loop->writing, capacity * sizeof(int));
+
+        if (!writing) {
+            return -1;
+        }
+        loop->writing = writing;
+        loop->capacity = capacity;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = session};
+
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, linkFd(session), &event) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    loop->writing[loop->nSessions] = FALSE;
+    loop->sessions[loop->nSessions++] = session;
+    loop->changed = TRUE;
+    return 0;
+}
+
+// Wait for writing on (or stop waiting on) the write file descriptor of
+// session, the i-th one. For serial ports and sockets it is the one they read
+// from; the I/O threads have one of their own.
+static void setWriting(LinkLoop *loop, int i, int writing) {
+    LinkSession *session = loop->sessions[i];
+    int fd = linkWriteFd(session);
+
+    if (fd == linkFd(session)) {
+        struct epoll_event event = {.events = EPOLLIN | (writing ? EPOLLOUT : 0), .data.ptr = session};
+
+        epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, fd, &event);
+    } else {
+        struct epoll_event event = {.events = EPOLLOUT, .data.ptr = session};
+
+        epoll_ctl(loop->epollFd, writing ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &event);
+    }
+    loop->writing[i] = writing;
+}
+
+void loopRemove(LinkLoop *loop, LinkSession *session) {
+
+    int i = findSession(loop, session);
+
+    if (i < 0) {
+        return;
+    }
+
+    if (loop->writing[i]) {
+        setWriting(loop, i, FALSE);
+    }
+    epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, linkFd(session), NULL);
+
+    loop->nSessions--;
+    loop->sessions[i] = loop->sessions[loop->nSessions];
+    loop->writing[i] = loop->writing[loop->nSessions];
+    loop->changed = TRUE;
+}
+
+// Run every session's retransmission timer. Return the seconds until the first
+// one runs out, or -1 if none is running.
+static double processTimers(LinkLoop *loop) {
+
+    double wait;
+
+    // A callback may add or remove sessions, so start over when one does
+    do {
+        loop->changed = FALSE;
+        wait = -1;
+
+        for (int i = 0; i < loop->nSessions && !loop->changed && !loop->stopped; i++) {
+            double left = linkProcessTimer(loop->sessions[i]);
+
+            if (left >= 0 && (wait < 0 || left < wait)) {
+                wait = left;
+            }
+        }
+    } while (loop->changed && !loop->stopped);
+
+    return wait;
+}
+
+// Wait for the ports of the sessions with a partly written frame to be
+// writable as well, and stop once they aren't.
+static void watchOutput(LinkLoop *loop) {
+
+    for (int i = 0; i < loop->nSessions; i++) {
+        LinkSession *session = loop->sessions[i];
+        int writing = linkOutputPending(session) && linkWriteFd(session) >= 0;
+
+        if (writing != loop->writing[i]) {
+            setWriting(loop, i, writing);
+        }
+    }
+}
+
+int loopRun(LinkLoop *loop) {
+    return loopRunFor(loop, -1);
+}
+
+int loopRunFor(LinkLoop *loop, double seconds) {
+
+    struct epoll_event events[MAX_EVENTS];
+    double end = linkTime() + seconds;
+
+    loop->stopped = FALSE;
+
+    while (!loop->stopped && loop->nSessions > 0) {
+
+        double wait = processTimers(loop);
+        double left = end - linkTime();
+
+        if (loop->stopped || (seconds >= 0 && left <= 0)) {
+            break;
+        }
+
+        if (seconds >= 0 && (wait < 0 || left < wait)) {
+            wait = left;
+        }
+
+        watchOutput(loop);
+
+        // Round up, so the timer has run out when we wake up
+        int timeout = wait < 0 ? -1 : (int) (wait * 1000) + 1;
+        int nEvents = epoll_wait(loop->epollFd, events, MAX_EVENTS, timeout);
+
+        if (nEvents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < nEvents && !loop->stopped; i++) {
+            LinkSession *session = events[i].data.ptr;
+
+            // A callback may have removed it already
+            if (findSession(loop, session) < 0) {
+                continue;
+            }
+
+            if ((events[i].events & EPOLLOUT) && linkProcessOutput(session) < 0) {
+                perror("Error writing to the serial port");
+                loopRemove(loop, session);
+                continue;
+            }
+
+            if (!(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) || findSession(loop, session) < 0) {
+                continue;
+            }
+
+            if (linkProcessInput(session) < 0) {
+                perror("Error reading from the serial port");
+                loopRemove(loop, session);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void loopStop(LinkLoop *loop) {
+    loop->stopped = TRUE;
+}
+
+void loopDestroy(LinkLoop *loop) {
+    close(loop->epollFd);
+    free(loop->sessions);
+    free(loop->writing);
+    free(loop);
+}
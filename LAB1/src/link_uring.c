@@ -0,0 +1,546 @@
+// io_uring serial port backend implementation
+//
+// Reads fill a FIFO of registered buffers, so the next one is in flight while
+// the bytes of the previous ones are taken; only one is in flight at a time,
+// since two reads of the same port could complete in any order. The
+// registered eventfd tells epoll when bytes arrive. Writes queue up in a FIFO
+// of registered buffers just the same, small ones sharing the last buffer, and
+// every buffer ready goes out at once in a chain of linked writes, which the
+// kernel runs in order. Every system call submits whatever was queued since
+// the last one, and nothing is queued without room for it in the submission
+// queue.
+//
+// When every write buffer is in use, uringWrite() takes what fits and makes
+// writableFd not writable, like ioWrite(). Each chain of writes ends with a
+// read of writableFd, so the kernel makes it writable again as soon as the
+// chain is written, whether or not anyone reaps the completions meanwhile.
+
+#include "link_uring.h"
+#include "link_layer.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Submission queue entries: a read, its timeout and a chain of writes of every
+// write buffer, with room
+#define URING_ENTRIES 16
+
+// Registered buffers for writes, each holding up to URING_BUFFER_SIZE bytes
+#define URING_WRITE_BUFFERS 8
+#define URING_BUFFER_SIZE 4096
+
+// Registered buffers for reads
+#define URING_READ_BUFFERS 4
+
+// Bytes asked for by each read: what linkProcessInput() takes at once, so an
+// event loop never leaves received bytes behind
+#define URING_READ_SIZE MAX_PAYLOAD_SIZE
+
+// Nanoseconds a read waits before it is cancelled (0.1 second, like VTIME)
+#define URING_READ_TIMEOUT 100000000
+
+// Written to writableFd so it doesn't poll writable (POLLOUT) until it is read,
+// on top of the 1 written for each chain of writes (see startWrite())
+#define EVENTFD_FULL 0xfffffffffffffffeULL
+
+// user_data of each kind of request; reads and writes add their buffer's index
+#define TAG_TIMEOUT 1
+#define TAG_WRITABLE 2
+#define TAG_READ 16
+#define TAG_WRITE 32
+
+struct UringIo {
+    int fd;
+    int ringFd;
+    int eventFd;        // Registered: signalled on each completion
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned sqEntries;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned toSubmit;
+
+    int reading;
+    unsigned readsDone;     // Reads completed, with bytes or at their timeout
+    struct __kernel_timespec readTimeout;
+
+    // Circular FIFO of read buffers holding bytes read but not taken by
+    // uringRead() yet, from readStart; the read in flight fills the one after
+    // the last
+    unsigned char readBuffers[URING_READ_BUFFERS][URING_READ_SIZE];
+    int readSize[URING_READ_BUFFERS];
+    int taken[URING_READ_BUFFERS];
+    int readStart;
+    int readLength;
+
+    // Circular FIFO of write buffers holding bytes to write, from queueStart;
+    // a chain of writes of the first ones is in flight while writesInFlight > 0
+    unsigned char writeBuffers[URING_WRITE_BUFFERS][URING_BUFFER_SIZE];
+    int writeSize[URING_WRITE_BUFFERS];
+    int written[URING_WRITE_BUFFERS];
+    int sending[URING_WRITE_BUFFERS];   // In the chain in flight: no more bytes go in
+    int queueStart;
+    int queueLength;
+    int writesInFlight;     // Requests of the chain, with the read of writableFd that ends it
+
+    int writableFd;         // Writable (POLLOUT) while a write buffer is free
+    uint64_t writableCount;
+    struct iovec writableIov;
+
+    int failed;
+    int stopping;       // No more reads, see uringStop()
+};
+
+static int setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int enter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int registerRing(int ringFd, unsigned opcode, void *arg, unsigned n) {
+    return syscall(__NR_io_uring_register, ringFd, opcode, arg, n);
+}
+
+static void submit(UringIo *io, int wait);
+
+// Make room for n requests in the submission queue, submitting what is queued
+// if it is full. Return FALSE if there is still no room (try again later).
+static int reserve(UringIo *io, unsigned n) {
+    unsigned used = *io->sqTail - __atomic_load_n(io->sqHead, __ATOMIC_ACQUIRE);
+
+    if (used + n > io->sqEntries) {
+        submit(io, FALSE);
+        used = *io->sqTail - __atomic_load_n(io->sqHead, __ATOMIC_ACQUIRE);
+    }
+    return used + n <= io->sqEntries;
+}
+
+// Queue a request, after reserve(); it is submitted with the next system call.
+static struct io_uring_sqe *newRequest(UringIo *io) {
+    unsigned tail = *io->sqTail;
+    unsigned index = tail & *io->sqMask;
+    struct io_uring_sqe *sqe = &io->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    io->sqArray[index] = index;
+    __atomic_store_n(io->sqTail, tail + 1, __ATOMIC_RELEASE);
+    io->toSubmit++;
+
+    return sqe;
+}
+
+// Submit what is queued and, if wait == TRUE, wait for a completion.
+static void submit(UringIo *io, int wait) {
+
+    if (io->toSubmit == 0 && !wait) {
+        return;
+    }
+
+    int submitted = enter(io->ringFd, io->toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+
+    if (submitted >= 0) {
+        io->toSubmit -= submitted;
+    } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter");
+        io->failed = TRUE;
+    }
+}
+
+// Queue a read with its timeout into the next free read buffer, unless one is
+// in flight or every buffer holds bytes.
+static void startRead(UringIo *io) {
+
+    if (io->reading || io->failed || io->stopping || io->readLength == URING_READ_BUFFERS || !reserve(io, 2)) {
+        return;
+    }
+
+    int b = (io->readStart + io->readLength) % URING_READ_BUFFERS;
+
+    struct io_uring_sqe *read = newRequest(io);
+    read->opcode = IORING_OP_READ_FIXED;
+    read->fd = io->fd;
+    read->addr = (uintptr_t)io->readBuffers[b];
+    read->len = URING_READ_SIZE;
+    read->off = (uint64_t)-1;
+    read->buf_index = b;
+    read->flags = IOSQE_IO_LINK;
+    read->user_data = TAG_READ + b;
+
+    struct io_uring_sqe *timeout = newRequest(io);
+    timeout->opcode = IORING_OP_LINK_TIMEOUT;
+    timeout->fd = -1;
+    timeout->addr = (uintptr_t)&io->readTimeout;
+    timeout->len = 1;
+    timeout->user_data = TAG_TIMEOUT;
+
+    io->reading = TRUE;
+}
+
+// Queue a chain of writes of what is left in the buffers of the FIFO, as many
+// as the submission queue has room for, followed by a read of writableFd,
+// unless a chain is in flight already. Writes that could run side by side
+// might reach the port in any order, so the next chain waits for this one.
+static void startWrite(UringIo *io) {
+
+    if (io->writesInFlight > 0 || io->failed || io->queueLength == 0 || !reserve(io, 2)) {
+        return;
+    }
+
+    unsigned used = *io->sqTail - __atomic_load_n(io->sqHead, __ATOMIC_ACQUIRE);
+    int n = (int)(io->sqEntries - used) - 1;
+
+    if (n > io->queueLength) {
+        n = io->queueLength;
+    }
+
+    // Keeps writableFd from being read with nothing in it, see uringWrite()
+    uint64_t one = 1;
+    (void)!write(io->writableFd, &one, sizeof(one));
+
+    for (int i = 0; i < n; i++) {
+        int b = (io->queueStart + i) % URING_WRITE_BUFFERS;
+        struct io_uring_sqe *write = newRequest(io);
+
+        write->opcode = IORING_OP_WRITE_FIXED;
+        write->fd = io->fd;
+        write->addr = (uintptr_t)(io->writeBuffers[b] + io->written[b]);
+        write->len = io->writeSize[b] - io->written[b];
+        write->off = (uint64_t)-1;
+        write->buf_index = URING_READ_BUFFERS + b;
+        write->flags = IOSQE_IO_LINK;
+        write->user_data = TAG_WRITE + b;
+
+        io->sending[b] = TRUE;
+    }
+
+    struct io_uring_sqe *writable = newRequest(io);
+
+    writable->opcode = IORING_OP_READV;
+    writable->fd = io->writableFd;
+    writable->addr = (uintptr_t)&io->writableIov;
+    writable->len = 1;
+    writable->off = (uint64_t)-1;
+    writable->user_data = TAG_WRITABLE;
+
+    io->writesInFlight = n + 1;
+}
+
+// Handle every completion posted so far.
+static void reap(UringIo *io) {
+    unsigned head = *io->cqHead;
+    unsigned tail = __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &io->cqes[head & *io->cqMask];
+        int res = cqe->res;
+
+        if (cqe->user_data >= TAG_READ && cqe->user_data < TAG_WRITE) {
+            int b = cqe->user_data - TAG_READ;
+
+            io->reading = FALSE;
+            io->readsDone++;
+
+            if (res > 0) {
+                io->readSize[b] = res;
+                io->taken[b] = 0;
+                io->readLength++;
+            } else if (res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+                errno = -res;
+                perror("io_uring read");
+                io->failed = TRUE;
+            }
+        } else if (cqe->user_data >= TAG_WRITE) {
+            int b = cqe->user_data - TAG_WRITE;
+
+            // After a short write, the rest of the chain is cancelled and
+            // goes out again with the next one
+            io->sending[b] = FALSE;
+            io->writesInFlight--;
+
+            if (res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+                errno = -res;
+                perror("io_uring write");
+                io->failed = TRUE;
+            } else if (res > 0 && (io->written[b] += res) == io->writeSize[b]) {
+                io->queueStart = (io->queueStart + 1) % URING_WRITE_BUFFERS;
+                io->queueLength--;
+            }
+        } else if (cqe->user_data == TAG_WRITABLE) {
+            io->writesInFlight--;
+
+            if (res < 0) {
+                // Cancelled along with the chain: make writableFd writable here
+                uint64_t count;
+                (void)!read(io->writableFd, &count, sizeof(count));
+            }
+        }
+    }
+
+    __atomic_store_n(io->cqHead, head, __ATOMIC_RELEASE);
+
+    startWrite(io);
+    startRead(io);
+}
+
+static void freeRing(UringIo *io) {
+    if (io->sqes && io->sqes != MAP_FAILED) {
+        munmap(io->sqes, io->sqesSize);
+    }
+    if (io->cqRing && io->cqRing != MAP_FAILED && io->cqRing != io->sqRing) {
+        munmap(io->cqRing, io->cqRingSize);
+    }
+    if (io->sqRing && io->sqRing != MAP_FAILED) {
+        munmap(io->sqRing, io->sqRingSize);
+    }
+    if (io->eventFd >= 0) {
+        close(io->eventFd);
+    }
+    if (io->writableFd >= 0) {
+        close(io->writableFd);
+    }
+    if (io->ringFd >= 0) {
+        close(io->ringFd);
+    }
+    free(io);
+}
+
+UringIo *uringStart(int fd) {
+    UringIo *io = calloc(1, sizeof(UringIo));
+    struct io_uring_params p;
+
+    if (!io) {
+        return NULL;
+    }
+
+    io->fd = fd;
+    io->eventFd = -1;
+    io->writableFd = -1;
+    io->writableIov.iov_base = &io->writableCount;
+    io->writableIov.iov_len = sizeof(io->writableCount);
+    io->readTimeout.tv_nsec = URING_READ_TIMEOUT;
+
+    memset(&p, 0, sizeof(p));
+    io->ringFd = setup(URING_ENTRIES, &p);
+
+    // One mapping for both rings (5.4) and linked timeouts (5.5, along with
+    // IORING_FEAT_NODROP)
+    if (io->ringFd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        freeRing(io);
+        return NULL;
+    }
+
+    io->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    io->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (io->cqRingSize > io->sqRingSize) {
+        io->sqRingSize = io->cqRingSize;
+    }
+    io->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    io->sqRing = mmap(NULL, io->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFd, IORING_OFF_SQ_RING);
+    io->cqRing = io->sqRing;
+    io->sqes = mmap(NULL, io->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFd, IORING_OFF_SQES);
+
+    if (io->sqRing == MAP_FAILED || io->sqes == MAP_FAILED) {
+        freeRing(io);
+        return NULL;
+    }
+
+    io->sqHead = (unsigned *)((char *)io->sqRing + p.sq_off.head);
+    io->sqTail = (unsigned *)((char *)io->sqRing + p.sq_off.tail);
+    io->sqMask = (unsigned *)((char *)io->sqRing + p.sq_off.ring_mask);
+    io->sqArray = (unsigned *)((char *)io->sqRing + p.sq_off.array);
+    io->cqHead = (unsigned *)((char *)io->cqRing + p.cq_off.head);
+    io->cqTail = (unsigned *)((char *)io->cqRing + p.cq_off.tail);
+    io->cqMask = (unsigned *)((char *)io->cqRing + p.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)((char *)io->cqRing + p.cq_off.cqes);
+    io->sqEntries = p.sq_entries;
+
+    // The read buffers come first, the write buffers follow them
+    struct iovec buffers[URING_READ_BUFFERS + URING_WRITE_BUFFERS];
+
+    for (int i = 0; i < URING_READ_BUFFERS; i++) {
+        buffers[i].iov_base = io->readBuffers[i];
+        buffers[i].iov_len = URING_READ_SIZE;
+    }
+    for (int i = 0; i < URING_WRITE_BUFFERS; i++) {
+        buffers[URING_READ_BUFFERS + i].iov_base = io->writeBuffers[i];
+        buffers[URING_READ_BUFFERS + i].iov_len = URING_BUFFER_SIZE;
+    }
+
+    io->eventFd = eventfd(0, EFD_NONBLOCK);
+    io->writableFd = eventfd(0, EFD_NONBLOCK);
+
+    if (io->eventFd < 0 || io->writableFd < 0 ||
+        registerRing(io->ringFd, IORING_REGISTER_BUFFERS, buffers, URING_READ_BUFFERS + URING_WRITE_BUFFERS) < 0 ||
+        registerRing(io->ringFd, IORING_REGISTER_EVENTFD, &io->eventFd, 1) < 0) {
+        freeRing(io);
+        return NULL;
+    }
+
+    startRead(io);
+    submit(io, FALSE);
+
+    if (io->failed) {
+        freeRing(io);
+        return NULL;
+    }
+
+    return io;
+}
+
+int uringRead(UringIo *io, unsigned char *bytes, int numBytes, int wait) {
+    int cleared = FALSE;
+
+    // Bytes already read are taken without a system call
+    if (io->readLength == 0) {
+        uint64_t count;
+
+        // Reset the eventfd before reaping, so a completion right after still
+        // wakes up epoll
+        (void)!read(io->eventFd, &count, sizeof(count));
+        cleared = TRUE;
+        reap(io);
+
+        if (wait && io->readLength == 0) {
+            unsigned readsDone = io->readsDone;
+
+            startRead(io);
+
+            // Until the read completes, with bytes or at its timeout
+            while (io->readsDone == readsDone && !io->failed) {
+                submit(io, TRUE);
+                reap(io);
+            }
+        }
+    }
+
+    int n = 0;
+
+    if (io->readLength > 0) {
+        int b = io->readStart;
+
+        n = io->readSize[b] - io->taken[b];
+
+        if (n > numBytes) {
+            n = numBytes;
+        }
+
+        memcpy(bytes, io->readBuffers[b] + io->taken[b], n);
+        io->taken[b] += n;
+
+        if (io->taken[b] == io->readSize[b]) {
+            io->readStart = (io->readStart + 1) % URING_READ_BUFFERS;
+            io->readLength--;
+        }
+    }
+
+    // The next read, if a buffer is free (or reap() queued it), goes out now
+    startRead(io);
+    submit(io, FALSE);
+
+    if (io->readLength > 0 && cleared) {
+        // Keep the eventfd readable for what is left
+        uint64_t one = 1;
+        (void)!write(io->eventFd, &one, sizeof(one));
+    }
+
+    return n == 0 && io->failed ? -1 : n;
+}
+
+int uringWrite(UringIo *io, const unsigned char *bytes, int numBytes) {
+    int queued = 0;
+
+    reap(io);
+
+    while (queued < numBytes && !io->failed) {
+        int b = (io->queueStart + io->queueLength + URING_WRITE_BUFFERS - 1) % URING_WRITE_BUFFERS;
+
+        // Bytes go after those in the last buffer while it has room, unless
+        // it is being written already
+        if (io->queueLength == 0 || io->sending[b] || io->writeSize[b] == URING_BUFFER_SIZE) {
+            if (io->queueLength == URING_WRITE_BUFFERS) {
+                break;
+            }
+
+            b = (io->queueStart + io->queueLength) % URING_WRITE_BUFFERS;
+            io->writeSize[b] = 0;
+            io->written[b] = 0;
+            io->queueLength++;
+        }
+
+        int n = numBytes - queued;
+
+        if (n > URING_BUFFER_SIZE - io->writeSize[b]) {
+            n = URING_BUFFER_SIZE - io->writeSize[b];
+        }
+
+        memcpy(io->writeBuffers[b] + io->writeSize[b], bytes + queued, n);
+        io->writeSize[b] += n;
+        queued += n;
+    }
+
+    if (queued < numBytes && io->writesInFlight > 0) {
+        // Until the read that ends the chain in flight takes it; if that
+        // already happened, writableFd stays writable and the caller tries
+        // again right away
+        uint64_t full = EVENTFD_FULL - 1;
+        (void)!write(io->writableFd, &full, sizeof(full));
+    }
+
+    startWrite(io);
+    submit(io, FALSE);
+
+    return io->failed ? -1 : queued;
+}
+
+int uringEventFd(UringIo *io) {
+    return io->eventFd;
+}
+
+int uringWritableFd(UringIo *io) {
+    return io->writableFd;
+}
+
+void uringStop(UringIo *io) {
+
+    if (!io) {
+        return;
+    }
+
+    io->stopping = TRUE;
+
+    while ((io->queueLength > 0 || io->writesInFlight > 0) && !io->failed) {
+        submit(io, TRUE);
+        reap(io);
+    }
+
+    // The read in flight targets io, so let its timeout end it first
+    while (io->reading && !io->failed) {
+        submit(io, TRUE);
+        reap(io);
+    }
+
+    freeRing(io);
+}
@@ -0,0 +1,231 @@
+// Command-line options implementation
+
+#include "options.h"
+#include "link_layer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+Options options = {
+    .compress = FALSE,
+    .compressThreads = 1,
+    .delta = FALSE,
+    .resume = FALSE,
+    .reconnect = FALSE,
+    .reconnectLimit = 0,
+    .files = NULL,
+    .nFiles = 0,
+    .duplex = FALSE,
+    .duplexTarget = ".",
+    .bondPorts = NULL,
+    .nBondPorts = 0,
+    .ioThreads = FALSE,
+    .ioUring = FALSE,
+    .messages = NULL,
+    .vtime = 1,
+    .lowLatency = FALSE,
+    .rtPriority = 0,
+    .flow = FLOW_NONE,
+};
+
+static int addFile(const char *filename) {
+    char **files = realloc(options.files, (options.nFiles + 1) * sizeof(char *));
+
+    if (!files) {
+        return -1;
+    }
+
+    options.files = files;
+    options.files[options.nFiles] = strdup(filename);
+
+    return options.files[options.nFiles++] ? 0 : -1;
+}
+
+// Add the comma-separated serial ports in list to the bonded ones.
+static int addBondPorts(const char *list) {
+    char *ports = strdup(list);
+
+    if (!ports) {
+        return -1;
+    }
+
+    for (char *port = strtok(ports, ","); port; port = strtok(NULL, ",")) {
+        char **bondPorts = realloc(options.bondPorts, (options.nBondPorts + 1) * sizeof(char *));
+
+        if (!bondPorts) {
+            return -1;
+        }
+
+        options.bondPorts = bondPorts;
+        options.bondPorts[options.nBondPorts++] = port;
+    }
+
+    return 0;
+}
+
+// Add the files listed in a manifest, one per line. Blank lines and lines
+// starting with '#' are ignored.
+static int readManifest(const char *manifest) {
+    FILE *file = fopen(manifest, "r");
+    char line[4096];
+
+    if (!file) {
+        perror(manifest);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        if (addFile(line) < 0) {
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Number of online cores, used as the default size of worker pools.
+static int coreCount() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+int parseOptions(int argc, char *argv[]) {
+
+    for (int i = 0; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "--compress")) {
+            options.compress = TRUE;
+            options.compressThreads = coreCount();
+        } else if (!strncmp(arg, "--compress=", 11)) {
+            options.compress = TRUE;
+            options.compressThreads = atoi(arg + 11);
+
+            if (options.compressThreads <= 0) {
+                printf("Invalid number of compression threads: %s\n", arg + 11);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--delta")) {
+            options.delta = TRUE;
+        } else if (!strcmp(arg, "--resume")) {
+            options.resume = TRUE;
+        } else if (!strcmp(arg, "--reconnect")) {
+            options.reconnect = TRUE;
+        } else if (!strncmp(arg, "--reconnect=", 12)) {
+            options.reconnect = TRUE;
+            options.reconnectLimit = atoi(arg + 12);
+
+            if (options.reconnectLimit <= 0) {
+                printf("Invalid reconnection time limit: %s\n", arg + 12);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--duplex")) {
+            options.duplex = TRUE;
+        } else if (!strncmp(arg, "--duplex=", 9)) {
+            options.duplex = TRUE;
+            options.duplexTarget = arg + 9;
+        } else if (!strncmp(arg, "--bond=", 7)) {
+            if (addBondPorts(arg + 7) < 0 || options.nBondPorts == 0) {
+                printf("Invalid list of bonded serial ports: %s\n", arg + 7);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--io-threads")) {
+            options.ioThreads = TRUE;
+        } else if (!strcmp(arg, "--io-uring")) {
+            options.ioUring = TRUE;
+        } else if (!strncmp(arg, "--messages=", 11)) {
+            if (arg[11] == '\0') {
+                printf("Missing file for messages\n");
+                return -1;
+            }
+            options.messages = arg + 11;
+        } else if (!strncmp(arg, "--vtime=", 8)) {
+            char *end;
+            options.vtime = strtol(arg + 8, &end, 10);
+
+            if (arg[8] == '\0' || *end != '\0' || options.vtime < 0 || options.vtime > 255) {
+                printf("Invalid read timeout (0 to 255 deciseconds): %s\n", arg + 8);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--low-latency")) {
+            options.lowLatency = TRUE;
+        } else if (!strncmp(arg, "--low-latency=", 14)) {
+            options.lowLatency = TRUE;
+            options.rtPriority = atoi(arg + 14);
+
+            if (options.rtPriority < 1 || options.rtPriority > 99) {
+                printf("Invalid realtime priority (1 to 99): %s\n", arg + 14);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--flow=rtscts")) {
+            options.flow = FLOW_RTSCTS;
+        } else if (!strcmp(arg, "--flow=xonxoff")) {
+            options.flow = FLOW_XONXOFF;
+        } else if (!strncmp(arg, "--flow=", 7)) {
+            printf("Invalid flow control (rtscts or xonxoff): %s\n", arg + 7);
+            return -1;
+        } else if (!strncmp(arg, "--manifest=", 11)) {
+            if (readManifest(arg + 11) < 0) {
+                return -1;
+            }
+        } else if (strncmp(arg, "--", 2) != 0) {
+            if (addFile(arg) < 0) {
+                return -1;
+            }
+        } else {
+            printf("Unknown option: %s\n", arg);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void printOptionsUsage() {
+    printf("Options:\n"
+           "  --compress[=threads]  compress data chunks on a pool of worker threads\n"
+           "                        (defaults to one thread per core)\n"
+           "  --delta               send only the blocks that differ from the receiver's\n"
+           "                        existing copy of the file\n"
+           "  --resume              continue an interrupted transfer from the last\n"
+           "                        offset committed by the receiver\n"
+           "  --reconnect[=seconds] when the link stops answering, keep trying to\n"
+           "                        re-establish it (forever by default) and resume\n"
+           "  --duplex[=target]     both ends send files at the same time (give it to\n"
+           "                        both); the receiver sends the files given after its\n"
+           "                        filename, the transmitter stores them in target\n"
+           "                        (the current directory by default)\n"
+           "  --bond=port[,port...] also stripe frames over these serial ports to the\n"
+           "                        same peer (give both ends their ports in the same\n"
+           "                        order)\n"
+           "  --io-threads          read and write the serial ports on threads of their\n"
+           "                        own, so the wire never waits for the protocol\n"
+           "  --io-uring            read and write the serial ports through io_uring\n"
+           "                        (falls back to read() and write() without it)\n"
+           "  --messages=file       transmitter: send each line read from file (e.g., a\n"
+           "                        FIFO) as a message, ahead of the file data;\n"
+           "                        receiver: append the messages to file instead of\n"
+           "                        printing them\n"
+           "  --vtime=deciseconds   how long a serial read waits for the first byte\n"
+           "                        (VTIME, 1 by default); 0 polls without waiting,\n"
+           "                        keeping a core busy\n"
+           "  --low-latency[=prio]  ask the serial driver for low-latency handling\n"
+           "                        (ASYNC_LOW_LATENCY) and lock the process in memory;\n"
+           "                        with a priority (1-99), also run it as SCHED_FIFO\n"
+           "  --flow=rtscts         hardware flow control of the serial ports (RTS/CTS)\n"
+           "  --flow=xonxoff        software flow control of the serial ports (XON/XOFF,\n"
+           "                        which frames then escape); give it to both ends\n"
+           "  --manifest=file       also send the files listed in file, one per line\n"
+           "  file...               also send these files in the same session\n"
+           "                        (the receiver stores them in its filename if it is a\n"
+           "                        directory, or next to it otherwise)\n");
+}
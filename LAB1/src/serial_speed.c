@@ -0,0 +1,35 @@
+// Serial port speeds without a B constant (see serialSetSpeed())
+//
+// <asm/termbits.h> defines its own struct termios, so this file can't include
+// <termios.h> (nor serial_port.h, which does).
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+int serialSetSpeed(int fd, int baudRate)
+{
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) == -1)
+    {
+        return -1;
+    }
+
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baudRate;
+    tio.c_ospeed = baudRate;
+
+    if (ioctl(fd, TCSETS2, &tio) == -1)
+    {
+        return -1;
+    }
+
+    // The driver rounds to the closest rate its clock can make
+    if (ioctl(fd, TCGETS2, &tio) == -1)
+    {
+        return -1;
+    }
+
+    return tio.c_ospeed;
+}
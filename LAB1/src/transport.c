@@ -0,0 +1,183 @@
+// Link transport implementation: backend selection and termios serial ports
+
+#include "transport.h"
+#include "link_io.h"
+#include "link_uring.h"
+#include "options.h"
+#include "serial_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+Transport *transportOpen(LinkLayer connectionParameters) {
+    const char *name = connectionParameters.serialPort;
+
+    if (!strncmp(name, "unix:", 5)) {
+        return socketTransportOpen(connectionParameters, name + 5, FALSE);
+    }
+    if (!strncmp(name, "tcp:", 4)) {
+        return socketTransportOpen(connectionParameters, name + 4, TRUE);
+    }
+    if (!strncmp(name, "shm:", 4)) {
+        return shmTransportOpen(connectionParameters, name + 4);
+    }
+
+    return serialTransportOpen(connectionParameters);
+}
+
+typedef struct {
+    Transport base;
+    int fd;
+    struct termios oldtio;
+    LinkIo *io;         // The port's I/O threads, or NULL to use it directly
+    UringIo *uring;     // The port's io_uring, or NULL
+} SerialTransport;
+
+// Used directly, the port is non-blocking so a write never waits for room.
+// Reads wait with poll() instead of VTIME.
+static int directRead(SerialTransport *t, unsigned char *bytes, int numBytes, int wait) {
+    struct pollfd p = {.fd = t->fd, .events = POLLIN};
+    int ready = poll(&p, 1, wait ? options.vtime * 100 : 0);
+
+    if (ready <= 0) {
+        return ready < 0 && errno != EINTR ? -1 : 0;
+    }
+
+    int n = read(t->fd, bytes, numBytes);
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    return n;
+}
+
+static int directWrite(SerialTransport *t, const unsigned char *bytes, int numBytes) {
+    int n = write(t->fd, bytes, numBytes);
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    return n;
+}
+
+static int serialTransportRead(Transport *transport, unsigned char *bytes, int numBytes, int wait) {
+    SerialTransport *t = (SerialTransport *)transport;
+
+    if (t->uring) {
+        return uringRead(t->uring, bytes, numBytes, wait);
+    }
+    if (t->io) {
+        return ioRead(t->io, bytes, numBytes, wait);
+    }
+    return directRead(t, bytes, numBytes, wait);
+}
+
+static int serialTransportWrite(Transport *transport, const unsigned char *bytes, int numBytes) {
+    SerialTransport *t = (SerialTransport *)transport;
+
+    if (t->uring) {
+        return uringWrite(t->uring, bytes, numBytes);
+    }
+    if (t->io) {
+        return ioWrite(t->io, bytes, numBytes);
+    }
+    return directWrite(t, bytes, numBytes);
+}
+
+static int serialTransportPollFd(Transport *transport) {
+    SerialTransport *t = (SerialTransport *)transport;
+
+    if (t->uring) {
+        return uringEventFd(t->uring);
+    }
+    return t->io ? ioEventFd(t->io) : t->fd;
+}
+
+static int serialTransportWriteFd(Transport *transport) {
+    SerialTransport *t = (SerialTransport *)transport;
+
+    if (t->uring) {
+        return uringWritableFd(t->uring);
+    }
+    return t->io ? ioWritableFd(t->io) : t->fd;
+}
+
+static int serialTransportOverruns(Transport *transport) {
+    return serialOverruns(((SerialTransport *)transport)->fd);
+}
+
+// Stop the I/O threads (or the io_uring) once they sent what is queued, and
+// close the port.
+static int serialTransportClose(Transport *transport) {
+    SerialTransport *t = (SerialTransport *)transport;
+
+    ioStop(t->io);
+    uringStop(t->uring);
+
+    int closed = serialClose(t->fd, &t->oldtio);
+    free(t);
+    return closed;
+}
+
+static const TransportOps serialOps = {
+    .read = serialTransportRead,
+    .write = serialTransportWrite,
+    .pollFd = serialTransportPollFd,
+    .writeFd = serialTransportWriteFd,
+    .overruns = serialTransportOverruns,
+    .close = serialTransportClose,
+};
+
+Transport *serialTransportOpen(LinkLayer connectionParameters) {
+    SerialTransport *t = calloc(1, sizeof(SerialTransport));
+
+    if (!t) {
+        return NULL;
+    }
+
+    t->base.ops = &serialOps;
+    t->fd = serialOpen(connectionParameters.serialPort, connectionParameters.baudRate, &t->oldtio);
+
+    if (t->fd < 0) {
+        free(t);
+        return NULL;
+    }
+
+    if (options.vtime != 1 && serialSetReadTimeout(t->fd, options.vtime) < 0) {
+        perror("tcsetattr");
+    }
+
+    if (options.flow != FLOW_NONE &&
+        serialSetFlowControl(t->fd, options.flow == FLOW_RTSCTS, options.flow == FLOW_XONXOFF) < 0) {
+        perror("tcsetattr");
+    }
+
+    if (options.lowLatency && serialSetLowLatency(t->fd) < 0) {
+        printf("%s doesn't support low-latency mode (ASYNC_LOW_LATENCY)\n", connectionParameters.serialPort);
+    }
+
+    if (options.ioUring && !(t->uring = uringStart(t->fd))) {
+        printf("io_uring is not available, using read() and write() on %s\n", connectionParameters.serialPort);
+    }
+
+    if (options.ioThreads && !t->uring && !(t->io = ioStart(t->fd))) {
+        printf("Failed to start the I/O threads of %s\n", connectionParameters.serialPort);
+        serialClose(t->fd, &t->oldtio);
+        free(t);
+        return NULL;
+    }
+
+    if (!t->io && !t->uring && fcntl(t->fd, F_SETFL, fcntl(t->fd, F_GETFL) | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        serialClose(t->fd, &t->oldtio);
+        free(t);
+        return NULL;
+    }
+
+    return &t->base;
+}
@@ -0,0 +1,279 @@
+// Link transport over a pair of shared-memory rings
+
+#include "transport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SHM_RING_SIZE (1 << 20) // Bytes in each direction, a power of 2
+
+// Segment states, see shmTransportOpen()
+#define SHM_READY    0x52434F4D // Created by the receiver
+#define SHM_ATTACHED 0x52434F4E // Taken by a transmitter
+
+// Milliseconds between the transmitter's looks for the segment
+#define ATTACH_RETRY_MS 100
+
+// A single-producer single-consumer byte ring. head and tail only grow (and
+// wrap around); the other side is woken with a futex on them when it waits.
+typedef struct {
+    atomic_uint head;           // Written by the producer
+    atomic_uint readerWaiting;
+    unsigned char pad1[56];
+    atomic_uint tail;           // Written by the consumer
+    atomic_uint writerWaiting;
+    unsigned char pad2[56];
+    unsigned char data[SHM_RING_SIZE];
+} ShmRing;
+
+typedef struct {
+    atomic_uint state;
+    unsigned char pad[60];
+    ShmRing rings[2];           // Transmitter to receiver, and back
+} ShmSegment;
+
+typedef struct {
+    Transport base;
+    ShmSegment *segment;
+    ShmRing *in;
+    ShmRing *out;
+    int owner;                  // Unlink the segment on closing
+    char name[256];
+} ShmTransport;
+
+// Wait up to timeoutMs for *word to change from value
+static void futexWait(atomic_uint *word, unsigned int value, int timeoutMs) {
+    struct timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futexWake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int shmRead(Transport *transport, unsigned char *bytes, int numBytes, int wait) {
+    ShmRing *ring = ((ShmTransport *)transport)->in;
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail && wait) {
+        // Checked again once the writer can see we wait, so no wake is lost
+        atomic_store(&ring->readerWaiting, 1);
+        head = atomic_load(&ring->head);
+
+        if (head == tail) {
+            futexWait(&ring->head, head, 100);
+            head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        }
+        atomic_store_explicit(&ring->readerWaiting, 0, memory_order_relaxed);
+    }
+
+    int n = head - tail;
+
+    if (n > numBytes) {
+        n = numBytes;
+    }
+
+    for (int i = 0; i < n; i++) {
+        bytes[i] = ring->data[(tail + i) & (SHM_RING_SIZE - 1)];
+    }
+
+    if (n > 0) {
+        atomic_store(&ring->tail, tail + n);
+
+        if (atomic_load(&ring->writerWaiting)) {
+            futexWake(&ring->tail);
+        }
+    }
+
+    return n;
+}
+
+static int shmWrite(Transport *transport, const unsigned char *bytes, int numBytes) {
+    ShmRing *ring = ((ShmTransport *)transport)->out;
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    int room = SHM_RING_SIZE - (head - tail);
+    int n = numBytes < room ? numBytes : room;
+
+    if (n == 0) {
+        // Full: give the reader a moment (it may be gone) before the caller
+        // tries again
+        atomic_store(&ring->writerWaiting, 1);
+
+        if (atomic_load(&ring->tail) == tail) {
+            futexWait(&ring->tail, tail, 100);
+        }
+        atomic_store_explicit(&ring->writerWaiting, 0, memory_order_relaxed);
+        return 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        ring->data[(head + i) & (SHM_RING_SIZE - 1)] = bytes[i];
+    }
+
+    atomic_store(&ring->head, head + n);
+
+    if (atomic_load(&ring->readerWaiting)) {
+        futexWake(&ring->head);
+    }
+
+    return n;
+}
+
+// There is no file descriptor to wait on: the link layer reads with wait ==
+// TRUE instead, and event loops can't drive the session.
+static int shmPollFd(Transport *transport) {
+    (void)transport;
+    return -1;
+}
+
+// A full ring makes shmWrite() wait a little instead
+static int shmWriteFd(Transport *transport) {
+    (void)transport;
+    return -1;
+}
+
+// The writer waits for room instead of dropping bytes: there is no overrun
+// count to show
+static int shmOverruns(Transport *transport) {
+    (void)transport;
+    return -1;
+}
+
+static int shmClose(Transport *transport) {
+    ShmTransport *t = (ShmTransport *)transport;
+    int closed = munmap(t->segment, sizeof(ShmSegment));
+
+    if (t->owner) {
+        shm_unlink(t->name);
+    }
+
+    free(t);
+    return closed;
+}
+
+static const TransportOps shmOps = {
+    .read = shmRead,
+    .write = shmWrite,
+    .pollFd = shmPollFd,
+    .writeFd = shmWriteFd,
+    .overruns = shmOverruns,
+    .close = shmClose,
+};
+
+// Receiver: replace any segment left behind with a new, ready one.
+static ShmSegment *createSegment(const char *name) {
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(ShmSegment)) < 0) {
+        perror(name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ShmSegment *segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (segment == MAP_FAILED) {
+        perror(name);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    atomic_store(&segment->state, SHM_READY);
+    return segment;
+}
+
+// Transmitter: wait up to seconds for the receiver's segment and take it. A
+// segment another transmitter took (or one left behind) is not ready.
+static ShmSegment *attachSegment(const char *name, int seconds) {
+    struct timespec retry = {0, ATTACH_RETRY_MS * 1000000L};
+    int attempts = seconds * 1000 / ATTACH_RETRY_MS;
+
+    for (int attempt = 0; attempt <= attempts; attempt++) {
+        if (attempt > 0) {
+            nanosleep(&retry, NULL);
+        }
+
+        int fd = shm_open(name, O_RDWR, 0);
+
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                continue;
+            }
+            perror(name);
+            return NULL;
+        }
+
+        struct stat st;
+
+        if (fstat(fd, &st) < 0 || st.st_size != sizeof(ShmSegment)) {
+            // Not sized by the receiver yet
+            close(fd);
+            continue;
+        }
+
+        ShmSegment *segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (segment == MAP_FAILED) {
+            perror(name);
+            return NULL;
+        }
+
+        unsigned int ready = SHM_READY;
+
+        if (atomic_compare_exchange_strong(&segment->state, &ready, SHM_ATTACHED)) {
+            return segment;
+        }
+        munmap(segment, sizeof(ShmSegment));
+    }
+
+    printf("No receiver created %s\n", name);
+    return NULL;
+}
+
+Transport *shmTransportOpen(LinkLayer connectionParameters, const char *name) {
+    ShmTransport *t = calloc(1, sizeof(ShmTransport));
+
+    if (!t) {
+        return NULL;
+    }
+
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->base.ops = &shmOps;
+    t->owner = connectionParameters.role == LlRx;
+
+    if (t->owner) {
+        t->segment = createSegment(name);
+    } else {
+        t->segment = attachSegment(name, connectionParameters.timeout * connectionParameters.nRetransmissions);
+    }
+
+    if (!t->segment) {
+        free(t);
+        return NULL;
+    }
+
+    t->out = &t->segment->rings[t->owner ? 1 : 0];
+    t->in = &t->segment->rings[t->owner ? 0 : 1];
+    return &t->base;
+}
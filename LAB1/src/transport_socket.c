@@ -0,0 +1,283 @@
+// Link transport over Unix and TCP stream sockets
+
+#include "transport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Milliseconds between the transmitter's attempts to connect
+#define CONNECT_RETRY_MS 100
+
+// No bigger than the reads of linkProcessInput() and linkPoll(), so they leave
+// nothing behind in the buffer while they wait for the socket to be readable
+#define SOCKET_BUFFER_SIZE MAX_PAYLOAD_SIZE
+
+typedef struct {
+    Transport base;
+    int fd;
+
+    // Received but not read yet, so reading a byte at a time doesn't cost
+    // two system calls per byte
+    unsigned char buffer[SOCKET_BUFFER_SIZE];
+    int bufferStart;
+    int bufferEnd;
+} SocketTransport;
+
+// Wait up to 0.1 second (if wait == TRUE) for bytes and receive them into the
+// buffer. Returns -1 on error, otherwise the number of bytes received.
+static int socketFill(SocketTransport *t, int wait) {
+    struct pollfd p = {.fd = t->fd, .events = POLLIN};
+
+    int ready = poll(&p, 1, wait ? 100 : 0);
+
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (ready == 0) {
+        return 0;
+    }
+
+    int n = recv(t->fd, t->buffer, sizeof(t->buffer), 0);
+
+    if (n < 0) {
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    }
+    if (n == 0) {
+        // The other end closed the connection
+        return -1;
+    }
+
+    t->bufferStart = 0;
+    t->bufferEnd = n;
+    return n;
+}
+
+static int socketRead(Transport *transport, unsigned char *bytes, int numBytes, int wait) {
+    SocketTransport *t = (SocketTransport *)transport;
+
+    if (t->bufferStart == t->bufferEnd) {
+        int n = socketFill(t, wait);
+
+        if (n <= 0) {
+            return n;
+        }
+    }
+
+    int n = t->bufferEnd - t->bufferStart;
+
+    if (n > numBytes) {
+        n = numBytes;
+    }
+    memcpy(bytes, t->buffer + t->bufferStart, n);
+    t->bufferStart += n;
+    return n;
+}
+
+static int socketWrite(Transport *transport, const unsigned char *bytes, int numBytes) {
+    SocketTransport *t = (SocketTransport *)transport;
+    int n = send(t->fd, bytes, numBytes, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    return n;
+}
+
+static int socketPollFd(Transport *transport) {
+    return ((SocketTransport *)transport)->fd;
+}
+
+static int socketWriteFd(Transport *transport) {
+    return ((SocketTransport *)transport)->fd;
+}
+
+// A stream socket never drops bytes: there is no overrun count to show
+static int socketOverruns(Transport *transport) {
+    (void)transport;
+    return -1;
+}
+
+static int socketClose(Transport *transport) {
+    SocketTransport *t = (SocketTransport *)transport;
+
+    int closed = close(t->fd);
+    free(t);
+    return closed;
+}
+
+static const TransportOps socketOps = {
+    .read = socketRead,
+    .write = socketWrite,
+    .pollFd = socketPollFd,
+    .writeFd = socketWriteFd,
+    .overruns = socketOverruns,
+    .close = socketClose,
+};
+
+// Resolve address ("path" for Unix sockets, "host:port" for TCP) into addr.
+// Returns -1 on error.
+static int resolve(const char *address, int tcp, struct sockaddr_storage *addr, socklen_t *addrLen) {
+    memset(addr, 0, sizeof(*addr));
+
+    if (!tcp) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+
+        if (strlen(address) >= sizeof(un->sun_path)) {
+            printf("Socket path too long: %s\n", address);
+            return -1;
+        }
+
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address);
+        *addrLen = sizeof(struct sockaddr_un);
+        return 0;
+    }
+
+    const char *colon = strrchr(address, ':');
+
+    if (!colon) {
+        printf("Expected tcp:host:port, got tcp:%s\n", address);
+        return -1;
+    }
+
+    char host[256];
+    int hostLen = colon - address;
+
+    if (hostLen >= (int)sizeof(host)) {
+        printf("Host name too long: %s\n", address);
+        return -1;
+    }
+    memcpy(host, address, hostLen);
+    host[hostLen] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+    struct addrinfo *result;
+
+    int error = getaddrinfo(hostLen ? host : NULL, colon + 1, &hints, &result);
+
+    if (error) {
+        printf("Can't resolve %s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addrLen = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+// Receiver: listen on addr and accept the transmitter's connection.
+static int acceptOne(const char *address, int tcp, const struct sockaddr_storage *addr, socklen_t addrLen) {
+    int listener = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listener < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    if (tcp) {
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    } else {
+        // Left behind by an earlier run
+        unlink(address);
+    }
+
+    if (bind(listener, (const struct sockaddr *)addr, addrLen) < 0 || listen(listener, 1) < 0) {
+        perror(address);
+        close(listener);
+        return -1;
+    }
+
+    int fd;
+
+    while ((fd = accept(listener, NULL, NULL)) < 0 && errno == EINTR) {
+    }
+
+    if (fd < 0) {
+        perror("accept");
+    }
+
+    close(listener);
+
+    if (!tcp) {
+        unlink(address);
+    }
+    return fd;
+}
+
+// Transmitter: connect to addr, retrying until the receiver listens or
+// seconds have passed.
+static int connectTo(const char *address, int tcp, const struct sockaddr_storage *addr, socklen_t addrLen, int seconds) {
+    struct timespec retry = {0, CONNECT_RETRY_MS * 1000000L};
+    int attempts = seconds * 1000 / CONNECT_RETRY_MS;
+
+    for (int attempt = 0; ; attempt++) {
+        int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+
+        if (connect(fd, (const struct sockaddr *)addr, addrLen) == 0) {
+            return fd;
+        }
+
+        int error = errno;
+        close(fd);
+
+        if ((error != ECONNREFUSED && error != ENOENT && error != EINTR) || attempt >= attempts) {
+            errno = error;
+            perror(address);
+            return -1;
+        }
+        nanosleep(&retry, NULL);
+    }
+}
+
+Transport *socketTransportOpen(LinkLayer connectionParameters, const char *address, int tcp) {
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+
+    if (resolve(address, tcp, &addr, &addrLen) < 0) {
+        return NULL;
+    }
+
+    SocketTransport *t = malloc(sizeof(SocketTransport));
+
+    if (!t) {
+        return NULL;
+    }
+
+    t->base.ops = &socketOps;
+
+    if (connectionParameters.role == LlRx) {
+        t->fd = acceptOne(address, tcp, &addr, addrLen);
+    } else {
+        t->fd = connectTo(address, tcp, &addr, addrLen,
+                          connectionParameters.timeout * connectionParameters.nRetransmissions);
+    }
+
+    if (t->fd < 0) {
+        free(t);
+        return NULL;
+    }
+
+    if (tcp) {
+        // Frames are small and each one waits for its acknowledgement
+        int on = 1;
+        setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    return &t->base;
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+# Compression thread-count benchmark
+#
+# Sends a compressible file over the shared-memory transport, which has no
+# baud-rate limit, first without --compress and then with 1, 2, 4... worker
+# threads up to the number of cores (at least 8). Prints the transfer time and
+# the CPU time of the transmitter for each run, and checks the received file.
+#
+# Usage: ./bench_compress.sh [megabytes]   (16 by default)
+
+cd "$(dirname "$0")" || exit 1
+
+MAIN=../bin/main
+PORT=shm:/bench_compress
+SIZE=$((${1:-16} * 1024 * 1024))
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# The sources over and over: text that compresses to about half
+while [ "$(stat -c %s "$DIR/in" 2>/dev/null || echo 0)" -lt "$SIZE" ]; do
+    cat ../src/*.c ../include/*.h >> "$DIR/in"
+done
+truncate -s "$SIZE" "$DIR/in"
+
+# Send the file with the given transmitter options and print one result line.
+run() {
+    local label=$1
+    shift
+
+    rm -f "$DIR/out"
+    $MAIN $PORT 115200 rx "$DIR/out" > "$DIR/rx.log" 2>&1 &
+    local rx=$!
+
+    local TIMEFORMAT="%R %U %S"
+    local times
+    times=$( { time $MAIN $PORT 115200 tx "$DIR/in" "$@" > "$DIR/tx.log" 2>&1; } 2>&1 )
+    wait $rx
+
+    local status=ok
+    cmp -s "$DIR/in" "$DIR/out" || status=FAILED
+
+    read -r real user sys <<< "$times"
+    printf "%-14s %9.2f %9.2f %9.2f  %s\n" "$label" "$real" "$user" "$sys" "$status"
+}
+
+echo "$((SIZE / 1024 / 1024)) MB over $PORT, $(nproc) cores"
+printf "%-14s %9s %9s %9s\n" "threads" "real (s)" "user (s)" "sys (s)"
+
+run "none"
+
+# At least up to 8, to see the cost of more threads than cores
+cores=$(nproc)
+most=$((cores > 8 ? cores : 8))
+
+threads=1
+while [ $threads -le $most ]; do
+    run "$threads" --compress=$threads
+    threads=$((threads * 2))
+done
+
+if [ $((threads / 2)) -ne $most ]; then
+    run "$most" --compress=$most
+fi
@@ -0,0 +1,106 @@
+#!/bin/bash
+# Event loop benchmark
+#
+# Sends the same file over 1, 2, 4... 64 links bonded together (--bond), each
+# side driving all of its links from one event loop. The links are pairs of
+# pseudo-terminals joined by pty_bridge. A single link runs without --bond, so
+# without the event loop.
+#
+# Opening the links is timed apart, up to the transmitter sending the START
+# packet: a SET frame that arrives before the receiver opened its port is only
+# sent again after the timeout, so the setup time varies from run to run. The
+# transfer time and the CPU time of each side are counted from there on: with
+# one thread waiting on every port in epoll, the CPU time should stay about the
+# same however many links carry the file.
+#
+# Usage: ./bench_links.sh [megabytes]   (4 by default)
+
+cd "$(dirname "$0")" || exit 1
+
+MAIN=../bin/main
+MAX_LINKS=64
+SIZE=$((${1:-4} * 1024 * 1024))
+DIR=$(mktemp -d)
+
+../bin/pty_bridge $MAX_LINKS > "$DIR/ports" &
+BRIDGE=$!
+trap 'kill $BRIDGE; rm -rf "$DIR"' EXIT
+
+head -c "$SIZE" /dev/urandom > "$DIR/in"
+
+while [ "$(wc -l < "$DIR/ports")" -lt $MAX_LINKS ]; do
+    sleep 0.1
+done
+mapfile -t PORTS < "$DIR/ports"
+
+# Print the CPU time (user and system, in seconds) process pid used so far.
+cpuTime() {
+    awk -v ticks="$(getconf CLK_TCK)" '{ print ($14 + $15) / ticks }' "/proc/$1/stat" 2> /dev/null || echo 0
+}
+
+# Send the file over nLinks links and print one result line.
+run() {
+    local nLinks=$1
+    local tx rx txBond="" rxBond=""
+
+    read -r tx rx <<< "${PORTS[0]}"
+
+    for ((i = 1; i < nLinks; i++)); do
+        read -r a b <<< "${PORTS[$i]}"
+        txBond="$txBond,$a"
+        rxBond="$rxBond,$b"
+    done
+
+    local txOptions=() rxOptions=()
+    if [ "$nLinks" -gt 1 ]; then
+        txOptions=(--bond="${txBond#,}")
+        rxOptions=(--bond="${rxBond#,}")
+    fi
+
+    local TIMEFORMAT="%R %U %S"
+
+    rm -f "$DIR/out" "$DIR/tx.log"
+    { time stdbuf -oL $MAIN "$rx" 115200 rx "$DIR/out" "${rxOptions[@]}" > "$DIR/rx.log" 2>&1; } 2> "$DIR/rx.time" &
+    local rxShell=$!
+    sleep 0.2
+
+    local start
+    start=$(date +%s.%N)
+    { time stdbuf -oL $MAIN "$tx" 115200 tx "$DIR/in" "${txOptions[@]}" > "$DIR/tx.log" 2>&1; } 2> "$DIR/tx.time" &
+    local txShell=$!
+
+    # Sample both sides once the links are open
+    local txPid rxPid
+    until txPid=$(pgrep -P $txShell) && rxPid=$(pgrep -P $rxShell) || ! kill -0 $txShell $rxShell 2> /dev/null; do
+        sleep 0.01
+    done
+    until grep -q "Sending START" "$DIR/tx.log" 2> /dev/null || ! kill -0 "$txPid" 2> /dev/null; do
+        sleep 0.01
+    done
+
+    local setup txSetupCpu rxSetupCpu
+    setup=$(awk "BEGIN { print $(date +%s.%N) - $start }")
+    txSetupCpu=$(cpuTime "$txPid")
+    rxSetupCpu=$(cpuTime "$rxPid")
+
+    wait $txShell $rxShell
+
+    local status=ok
+    cmp -s "$DIR/in" "$DIR/out" || status=FAILED
+
+    local real txUser txSys rxReal rxUser rxSys
+    read -r real txUser txSys < "$DIR/tx.time"
+    read -r rxReal rxUser rxSys < "$DIR/rx.time"
+
+    printf "%-6s %9.2f %9.2f %9.2f %9.2f  %s\n" "$nLinks" "$setup" \
+        "$(awk "BEGIN { print $real - $setup }")" \
+        "$(awk "BEGIN { print $txUser + $txSys - $txSetupCpu }")" \
+        "$(awk "BEGIN { print $rxUser + $rxSys - $rxSetupCpu }")" "$status"
+}
+
+echo "$((SIZE / 1024 / 1024)) MB over pseudo-terminal pairs"
+printf "%-6s %9s %9s %9s %9s\n" "links" "setup (s)" "transfer" "tx CPU" "rx CPU"
+
+for nLinks in 1 2 4 8 16 32 64; do
+    run $nLinks
+done
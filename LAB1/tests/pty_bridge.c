@@ -0,0 +1,105 @@
+// Pseudo-terminal bridge for the benchmarks
+//
+// Creates pairs of pseudo-terminals and copies the bytes written to one side of
+// each pair to the other, like a null-modem cable, so the application can open
+// many links without serial ports. Prints the two device names of each pair,
+// "TX RX" on a line of their own, then copies until killed.
+//
+// Usage: pty_bridge nPairs
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define MAX_PAIRS 128
+#define MAX_EVENTS 64
+
+// Open a pseudo-terminal in raw mode and return its master side. The slave
+// side stays open too, so the master doesn't hang up while the application
+// has it closed.
+static int openPty(char *name, size_t size) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    snprintf(name, size, "%s", ptsname(master));
+
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+
+    if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+        perror(name);
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    return master;
+}
+
+int main(int argc, char *argv[]) {
+    int nPairs = argc > 1 ? atoi(argv[1]) : 0;
+
+    if (nPairs <= 0 || nPairs > MAX_PAIRS) {
+        printf("Usage: %s nPairs (1 to %d)\n", argv[0], MAX_PAIRS);
+        return 1;
+    }
+
+    int epollFd = epoll_create1(0);
+    int peer[4 * MAX_PAIRS + 16];  // Indexed by file descriptor: master and slave of each pty
+
+    for (int i = 0; i < nPairs; i++) {
+        char tx[64];
+        char rx[64];
+        int a = openPty(tx, sizeof(tx));
+        int b = openPty(rx, sizeof(rx));
+
+        if (a < 0 || b < 0 || a >= (int)(sizeof(peer) / sizeof(peer[0])) || b >= (int)(sizeof(peer) / sizeof(peer[0]))) {
+            return 1;
+        }
+
+        peer[a] = b;
+        peer[b] = a;
+
+        struct epoll_event event = {.events = EPOLLIN};
+
+        event.data.fd = a;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, a, &event);
+        event.data.fd = b;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, b, &event);
+
+        printf("%s %s\n", tx, rx);
+    }
+
+    fflush(stdout);
+
+    while (1) {
+        struct epoll_event events[MAX_EVENTS];
+        int nEvents = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+
+        for (int i = 0; i < nEvents; i++) {
+            int fd = events[i].data.fd;
+            unsigned char buf[4096];
+            int n = read(fd, buf, sizeof(buf));
+
+            for (int done = 0; n > 0 && done < n; ) {
+                int written = write(peer[fd], buf + done, n - done);
+
+                if (written < 0) {
+                    break;
+                }
+                done += written;
+            }
+        }
+    }
+}
@@ -0,0 +1,138 @@
+// Test of the C++20 coroutine front-end (link_async.hpp)
+//
+// Two tasks on one rcom::EventLoop open the two ends of a link over a Unix
+// socket, and one sends packets of every size to the other, which checks them.
+// The transmitter leaves its Session open, so its destructor closes the link
+// (the DISC handshake) while the receiver closes its end with co_await
+// close(). Exits with "1" if any check fails.
+
+#include "link_async.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Packets sent over the link
+#define PACKETS 300
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                                   \
+    do {                                                        \
+        if (!(condition)) {                                     \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            failures++;                                         \
+        }                                                       \
+    } while (0)
+
+// Size and contents of the i-th packet.
+static int packetSize(int i) {
+    return 1 + (i * 37) % (MAX_PAYLOAD_SIZE - 1);
+}
+
+static unsigned char packetByte(int i, int j) {
+    return static_cast<unsigned char>(i * 7 + j * 13);
+}
+
+static LinkLayer parameters(const char *port, LinkLayerRole role) {
+    LinkLayer p = {};
+
+    snprintf(p.serialPort, sizeof(p.serialPort), "%s", port);
+    p.role = role;
+    p.baudRate = 115200;
+    p.nRetransmissions = 3;
+    p.timeout = 1;
+    return p;
+}
+
+static int packetsSent = 0;
+static int packetsReceived = 0;
+static int receiverClosed = -1;
+
+static rcom::Task transmit(rcom::EventLoop &loop, LinkLayer p) {
+    rcom::Session link = co_await loop.open(p);
+
+    if (!link) {
+        co_return;
+    }
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+
+    for (int i = 0; i < PACKETS; i++) {
+        for (int j = 0; j < packetSize(i); j++) {
+            packet[j] = packetByte(i, j);
+        }
+
+        // Resumes with the size of the frame, after byte stuffing
+        if (co_await link.write(packet, packetSize(i)) <= 0) {
+            co_return;
+        }
+        packetsSent++;
+    }
+
+    // link goes out of scope still open: ~Session closes it
+}
+
+static rcom::Task receive(rcom::EventLoop &loop, LinkLayer p) {
+    rcom::Session link = co_await loop.open(p);
+
+    if (!link) {
+        co_return;
+    }
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+
+    for (int i = 0; i < PACKETS; i++) {
+        int size = co_await link.read(packet);
+        int same = size == packetSize(i);
+
+        for (int j = 0; same && j < size; j++) {
+            same = packet[j] == packetByte(i, j);
+        }
+
+        if (!same) {
+            break;
+        }
+        packetsReceived++;
+    }
+
+    receiverClosed = co_await link.close();
+}
+
+int main() {
+    char port[50];
+
+    snprintf(port, sizeof(port), "unix:/tmp/test_async.%d", (int)getpid());
+
+    // The link layer reports every frame on stdout
+    fflush(stdout);
+    int out = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+
+    rcom::EventLoop loop;
+
+    loop.spawn(receive(loop, parameters(port, LlRx)));
+    loop.spawn(transmit(loop, parameters(port, LlTx)));
+
+    int result = loop.run();
+
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(null);
+    close(out);
+
+    CHECK(result == 0, "the event loop failed");
+    CHECK(packetsSent == PACKETS, "%d of %d packets were sent", packetsSent, PACKETS);
+    CHECK(packetsReceived == PACKETS, "%d of %d packets arrived whole", packetsReceived, PACKETS);
+    CHECK(receiverClosed >= 0, "the receiver didn't close the link with the DISC handshake");
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All link coroutine checks passed\n");
+    return 0;
+}
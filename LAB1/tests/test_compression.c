@@ -0,0 +1,232 @@
+// Tests of the chunk codec and the chunk pipeline
+//
+// Every chunk compressChunk() produces must come back unchanged through
+// decompressChunk(), and neither may write past the capacity it is given,
+// even for malformed input. The pipeline must hand chunks back in file order
+// whatever the number of workers. Exits with "1" if any check fails.
+
+#include "checksum.h"
+#include "chunk_pipeline.h"
+#include "compression.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes after the capacity given to the codec, which must stay untouched
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xA5
+
+// Chunks in the file given to the pipeline
+#define PIPELINE_CHUNKS 300
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                                   \
+    do {                                                        \
+        if (!(condition)) {                                     \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            failures++;                                         \
+        }                                                       \
+    } while (0)
+
+// Fill data with one of the kinds of content a file chunk may hold.
+static void fillChunk(unsigned char *data, int size, int kind) {
+    static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+
+    for (int i = 0; i < size; i++) {
+        switch (kind) {
+            case 0: data[i] = 0; break;
+            case 1: data[i] = text[i % (sizeof(text) - 1)]; break;
+            case 2: data[i] = rand(); break;
+            case 3: data[i] = i < size / 2 ? rand() : data[i - size / 2]; break;
+            default: data[i] = (i / 7) % 3 ? data[i > 40 ? i - 40 : 0] : rand(); break;
+        }
+    }
+}
+
+static int guardIntact(const unsigned char *guard) {
+    for (int i = 0; i < GUARD_SIZE; i++) {
+        if (guard[i] != GUARD_BYTE) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Compress and decompress size bytes of kind, checking the result and that
+// both stay within their capacity.
+static void testRoundTrip(int size, int kind) {
+    unsigned char raw[CHUNK_SIZE];
+    unsigned char packed[2 * CHUNK_SIZE + GUARD_SIZE];
+    unsigned char unpacked[CHUNK_SIZE + GUARD_SIZE];
+    int capacity = 2 * CHUNK_SIZE;
+
+    fillChunk(raw, size, kind);
+    memset(packed + capacity, GUARD_BYTE, GUARD_SIZE);
+    memset(unpacked + size, GUARD_BYTE, GUARD_SIZE);
+
+    int packedSize = compressChunk(raw, size, packed, capacity);
+
+    CHECK(packedSize > 0, "compressing %d bytes of kind %d failed", size, kind);
+    CHECK(guardIntact(packed + capacity), "compressing %d bytes of kind %d overran", size, kind);
+
+    if (packedSize <= 0) {
+        return;
+    }
+
+    int unpackedSize = decompressChunk(packed, packedSize, unpacked, size);
+
+    CHECK(unpackedSize == size, "%d bytes of kind %d came back as %d", size, kind, unpackedSize);
+    CHECK(unpackedSize != size || memcmp(raw, unpacked, size) == 0, "%d bytes of kind %d came back changed", size, kind);
+    CHECK(guardIntact(unpacked + size), "decompressing %d bytes of kind %d overran", size, kind);
+
+    // One byte short of the output fails instead of writing past it
+    if (size > 0) {
+        memset(unpacked + size - 1, GUARD_BYTE, GUARD_SIZE);
+        CHECK(decompressChunk(packed, packedSize, unpacked, size - 1) < 0, "%d bytes of kind %d fit in %d", size, kind, size - 1);
+        CHECK(guardIntact(unpacked + size - 1), "decompressing %d bytes of kind %d into %d overran", size, kind, size - 1);
+    }
+}
+
+// The pipeline only keeps compressed chunks that shrink, so compressChunk()
+// must fail cleanly when the output doesn't fit.
+static void testSmallCapacity() {
+    unsigned char raw[CHUNK_SIZE];
+    unsigned char packed[CHUNK_SIZE + GUARD_SIZE];
+
+    fillChunk(raw, CHUNK_SIZE, 2);
+
+    for (int capacity = 0; capacity < CHUNK_SIZE; capacity += 37) {
+        memset(packed + capacity, GUARD_BYTE, GUARD_SIZE);
+
+        CHECK(compressChunk(raw, CHUNK_SIZE, packed, capacity) < 0, "random chunk fit in %d bytes", capacity);
+        CHECK(guardIntact(packed + capacity), "compressing into %d bytes overran", capacity);
+    }
+}
+
+// Truncated and corrupted input must be rejected, or at least decompress
+// within the capacity.
+static void testMalformed() {
+    unsigned char raw[CHUNK_SIZE];
+    unsigned char packed[2 * CHUNK_SIZE];
+    unsigned char unpacked[CHUNK_SIZE + GUARD_SIZE];
+
+    fillChunk(raw, CHUNK_SIZE, 4);
+    int packedSize = compressChunk(raw, CHUNK_SIZE, packed, sizeof(packed));
+
+    CHECK(packedSize > 0, "compressing the malformed test chunk failed");
+
+    for (int n = 0; n < packedSize; n++) {
+        memset(unpacked + CHUNK_SIZE, GUARD_BYTE, GUARD_SIZE);
+
+        int size = decompressChunk(packed, n, unpacked, CHUNK_SIZE);
+
+        CHECK(size <= CHUNK_SIZE, "a %d-byte prefix decompressed to %d bytes", n, size);
+        CHECK(guardIntact(unpacked + CHUNK_SIZE), "a %d-byte prefix overran", n);
+    }
+
+    for (int i = 0; i < 2000; i++) {
+        unsigned char corrupt[2 * CHUNK_SIZE];
+
+        memcpy(corrupt, packed, packedSize);
+        corrupt[rand() % packedSize] = rand();
+        memset(unpacked + CHUNK_SIZE, GUARD_BYTE, GUARD_SIZE);
+
+        int size = decompressChunk(corrupt, packedSize, unpacked, CHUNK_SIZE);
+
+        CHECK(size <= CHUNK_SIZE, "a corrupted chunk decompressed to %d bytes", size);
+        CHECK(guardIntact(unpacked + CHUNK_SIZE), "a corrupted chunk overran");
+    }
+
+    // A match reaching back before the start of the output
+    unsigned char badOffset[] = {0x10, 'a', 0x02, 0x00};
+    CHECK(decompressChunk(badOffset, sizeof(badOffset), unpacked, CHUNK_SIZE) < 0, "an offset before the output was accepted");
+}
+
+// Run a file of mixed chunks through the pipeline with nThreads workers and
+// check that it comes back whole, in order, with the right checksum.
+static void testPipeline(int nThreads) {
+    int fileSize = PIPELINE_CHUNKS * CHUNK_SIZE - 123;
+    unsigned char *data = malloc(fileSize);
+    unsigned char *received = malloc(fileSize);
+    FILE *file = tmpfile();
+
+    if (!data || !received || !file) {
+        CHECK(FALSE, "no memory or temporary file for the pipeline test");
+        free(data);
+        free(received);
+        return;
+    }
+
+    for (int offset = 0; offset < fileSize; offset += CHUNK_SIZE) {
+        int size = fileSize - offset < CHUNK_SIZE ? fileSize - offset : CHUNK_SIZE;
+        fillChunk(data + offset, size, offset / CHUNK_SIZE % 5);
+    }
+
+    fwrite(data, 1, fileSize, file);
+    rewind(file);
+
+    CHECK(pipelineStart(file, TRUE, nThreads, CRC32C_INIT) == 0, "pipeline with %d threads didn't start", nThreads);
+
+    Chunk chunk;
+    int offset = 0;
+    int expectedSeq = 0;
+    int result;
+
+    while ((result = pipelineNext(&chunk)) > 0) {
+        CHECK(chunk.seq == expectedSeq, "chunk %d arrived as number %d", expectedSeq, chunk.seq);
+        expectedSeq++;
+
+        if (offset + chunk.rawSize > fileSize) {
+            CHECK(FALSE, "the pipeline returned more than the file");
+            break;
+        }
+
+        int size = chunk.compressed
+                   ? decompressChunk(chunk.data, chunk.size, received + offset, chunk.rawSize)
+                   : (memcpy(received + offset, chunk.data, chunk.size), chunk.size);
+
+        CHECK(size == chunk.rawSize, "chunk %d holds %d bytes instead of %d", chunk.seq, size, chunk.rawSize);
+        offset += chunk.rawSize;
+    }
+
+    CHECK(result == 0, "pipeline with %d threads failed", nThreads);
+    CHECK(offset == fileSize && memcmp(data, received, fileSize) == 0, "pipeline with %d threads changed the file", nThreads);
+    CHECK(pipelineChecksum() == crc32c(CRC32C_INIT, data, fileSize), "pipeline with %d threads got the checksum wrong", nThreads);
+
+    pipelineStop();
+    fclose(file);
+    free(data);
+    free(received);
+}
+
+int main() {
+    srand(1);
+
+    for (int kind = 0; kind < 5; kind++) {
+        testRoundTrip(0, kind);
+        testRoundTrip(1, kind);
+        testRoundTrip(CHUNK_SIZE, kind);
+
+        for (int i = 0; i < 200; i++) {
+            testRoundTrip(1 + rand() % CHUNK_SIZE, kind);
+        }
+    }
+
+    testSmallCapacity();
+    testMalformed();
+
+    for (int nThreads = 1; nThreads <= 8; nThreads *= 2) {
+        testPipeline(nThreads);
+    }
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All compression checks passed\n");
+    return 0;
+}